@@ -1,13 +1,20 @@
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <getopt.h>
 #include <inttypes.h>
+#include <arpa/inet.h>
 #include <rte_eal.h>
 #include <rte_ethdev.h>
 #include <rte_cycles.h>
 #include <rte_lcore.h>
+#include <rte_malloc.h>
 #include <rte_mbuf.h>
 #include <rte_udp.h>
 #include <rte_ether.h>
 #include <rte_ip.h>
+#include <rte_eth_ring.h>
 
 #define RX_RING_SIZE 1024
 #define TX_RING_SIZE 1024
@@ -15,9 +22,47 @@
 #define NUM_MBUFS 8191
 #define MBUF_CACHE_SIZE 250
 #define BURST_SIZE 32
+#define MAX_BURST 256
 
 #define PORT_ID 0
 
+/* preamble, start of frame delimiter and inter-frame gap of every frame on
+ * the wire, counted in the line rate */
+#define WIRE_OVERHEAD 20
+
+/* length of the size pattern a queue sends its templates in */
+#define MAX_TEMPLATES 64
+
+/* simple IMIX: frames of 64, 594 and 1518 bytes (40, 576 and 1500 bytes of
+ * IP packet) in the proportion 7:4:1 */
+#define IMIX_SPEC "64:7,594:4,1518:1"
+
+/* packets of its own a queue patches the flows into in flow mode, enough to
+ * cover a TX ring of packets not freed yet by the PMD */
+#define FLOW_SLOTS (2 * TX_RING_SIZE)
+
+/* the start of the UDP payload in latency mode, 18 bytes, which a frame of
+ * 64 bytes just has room for */
+#define STAMP_MAGIC 0x4c54
+#define STAMP_QUEUE_SHIFT 48
+struct latency_stamp
+{
+	uint16_t magic;
+	uint64_t tsc;			/* when it was sent */
+	uint64_t seq;			/* TX queue << 48 | sequence number */
+} __rte_packed;
+
+/* how long the receivers go on after the generator stops, for the packets
+ * on the way back not to be counted as lost */
+#define DRAIN_US 100000
+
+/* the latency histograms are laid out like an HdrHistogram: values below
+ * LAT_SUB_BUCKETS cycles are counted exactly, and every power of 2 above is
+ * split into LAT_SUB_BUCKETS/2 buckets, to within 1/32 of the value */
+#define LAT_SUB_BITS 6
+#define LAT_SUB_BUCKETS (1 << LAT_SUB_BITS)
+#define LAT_BUCKETS ((64 - LAT_SUB_BITS + 2) * (LAT_SUB_BUCKETS / 2))
+
 char msg[] = "hello from virtual machine";
 
 static const struct rte_eth_conf port_conf_default = {
@@ -26,11 +71,123 @@ static const struct rte_eth_conf port_conf_default = {
 	},
 };
 
+/* options of the generator */
+static uint16_t portid = PORT_ID;
+static uint16_t burst_size = BURST_SIZE;
+static double tx_rate;			/* per port, 0 for as fast as possible */
+static int rate_in_bits;		/* tx_rate is in bits/s, not packets/s */
+static double duration;			/* seconds, 0 for until interrupted */
+static double stats_period = 1.0;	/* seconds */
+
+/* the UDP checksum, 0 or filled in by the generator or by the NIC */
+enum
+{
+	UDP_CKSUM_NONE,
+	UDP_CKSUM_SW,
+	UDP_CKSUM_HW,
+};
+static int udp_cksum = UDP_CKSUM_NONE;
+
+/* the fields of the 5-tuple walked in flow mode, in host order.  the source
+ * port changes fastest, then the source address, the destination address
+ * and the destination port. */
+enum
+{
+	FLOW_SRC_PORT,
+	FLOW_SRC_IP,
+	FLOW_DST_IP,
+	FLOW_DST_PORT,
+	FLOW_FIELDS,
+};
+struct flow_range
+{
+	uint32_t first;
+	uint32_t count;
+};
+static struct flow_range flow_ranges[FLOW_FIELDS] = {
+	[FLOW_SRC_PORT] = {PORT_ID, 1},
+	[FLOW_SRC_IP] = {0xC0A8500A, 1},	/* 192.168.80.10 */
+	[FLOW_DST_IP] = {0xC0A85006, 1},	/* 192.168.80.6 */
+	[FLOW_DST_PORT] = {8080, 1},
+};
+static const char *const flow_options[FLOW_FIELDS] = {
+	"src-port", "src-ip", "dst-ip", "dst-port"};
+static int flow_mode;			/* more than one flow */
+
+static int latency_mode;		/* stamp the packets and receive them back */
+static int reflect_port = -1;		/* the port to bounce packets back on */
+static int ring_pair;			/* make two ring ports wired to each other */
+static int generate = 1;		/* send on portid, not only reflect */
+static int own_templates;		/* the templates are patched before sending */
+
+/* the frame sizes (including the FCS) the queues send, in order */
+static uint16_t pattern[MAX_TEMPLATES];
+static uint16_t pattern_len;
+
+static struct rte_mempool *mbuf_pool;
+
+static volatile int force_quit;		/* stop sending */
+static volatile int rx_quit;		/* stop receiving too */
+
+/* one TX queue, run by one worker lcore.  the templates are built once and
+ * sent over and over: every packet in a burst is a reference to a template,
+ * taken with rte_mbuf_refcnt_update(), which the PMD drops when it is done
+ * with the packet.  in flow and latency mode a template is only sent again
+ * once the PMD has dropped its reference, and the next flow and the stamp
+ * are patched into it first.  the counters are only written by the worker. */
+struct tx_queue
+{
+	uint16_t queue_id;
+	unsigned int lcore_id;
+	struct rte_mbuf **templates;	/* sent in turn */
+	double *cost;			/* tokens a template takes */
+	uint16_t nb_templates;
+	uint16_t next;			/* the template to send next */
+	uint16_t ready;			/* templates from next on patched already */
+	uint32_t flow[FLOW_FIELDS];	/* the next flow, offsets in the ranges */
+	uint64_t seq;			/* the sequence number to stamp next */
+
+	/* token bucket */
+	double tokens;
+	double tokens_per_cycle;
+	double bucket_depth;
+	uint64_t last;			/* TSC of the last refill */
+
+	uint64_t pkts;
+	uint64_t bytes;			/* frame bytes, including the FCS */
+	uint64_t unsent;		/* not taken by a full TX ring */
+} __rte_cache_aligned;
+
+static struct tx_queue tx_queues[RTE_MAX_LCORE];
+static uint16_t nb_tx_queues;
+
+/* the RX queue of the same number as a TX queue, polled by the same worker
+ * lcore.  in latency mode the packets back from every TX queue are matched
+ * by their sequence numbers: one lower than the highest seen from its TX
+ * queue is reordered, and one never seen is lost.  the latencies are in TSC
+ * cycles. */
+struct rx_queue
+{
+	uint64_t pkts;			/* stamped packets received */
+	uint64_t reordered;
+	uint64_t *received_from;	/* by TX queue */
+	uint64_t *next_seq;		/* by TX queue, one above the highest seen */
+
+	uint64_t lat_min;
+	uint64_t lat_max;
+	double lat_sum;
+	uint64_t latency[LAT_BUCKETS];
+
+	uint64_t reflected;		/* packets bounced back */
+	uint64_t dropped;		/* received but not bounced back */
+} __rte_cache_aligned;
+
+static struct rx_queue rx_queues[RTE_MAX_LCORE];
+
 static inline int
-port_init(uint16_t port, struct rte_mempool *mbuf_pool)
+port_init(uint16_t port, struct rte_mempool *mbuf_pool, uint16_t rx_rings, uint16_t tx_rings)
 {
 	struct rte_eth_conf port_conf = port_conf_default;
-	const uint16_t rx_rings = 1, tx_rings = 1;
 	uint16_t nb_rxd = RX_RING_SIZE;
 	uint16_t nb_txd = TX_RING_SIZE;
 	int retval;
@@ -49,9 +206,34 @@ port_init(uint16_t port, struct rte_mempool *mbuf_pool)
 		return retval;
 	}
 
-	if (dev_info.tx_offload_capa & DEV_TX_OFFLOAD_MBUF_FAST_FREE)
-		port_conf.txmode.offloads |=
-			DEV_TX_OFFLOAD_MBUF_FAST_FREE;
+	if (rx_rings > dev_info.max_rx_queues || tx_rings > dev_info.max_tx_queues)
+	{
+		printf("Port %u has %u RX and %u TX queues, %u and %u needed\n",
+			   port, dev_info.max_rx_queues, dev_info.max_tx_queues, rx_rings, tx_rings);
+		return -1;
+	}
+
+	/* spread the flows over the RX queues if the port can */
+	if (rx_rings > 1 && (dev_info.flow_type_rss_offloads & (ETH_RSS_IP | ETH_RSS_UDP)))
+	{
+		port_conf.rxmode.mq_mode = ETH_MQ_RX_RSS;
+		port_conf.rx_adv_conf.rss_conf.rss_hf =
+			dev_info.flow_type_rss_offloads & (ETH_RSS_IP | ETH_RSS_UDP);
+	}
+
+	/* DEV_TX_OFFLOAD_MBUF_FAST_FREE is not asked for, the packets sent
+	 * are references to templates whose refcnt is above 1. */
+	if (udp_cksum == UDP_CKSUM_HW)
+	{
+		if (dev_info.tx_offload_capa & DEV_TX_OFFLOAD_UDP_CKSUM)
+			port_conf.txmode.offloads |= DEV_TX_OFFLOAD_UDP_CKSUM;
+		else
+		{
+			printf("Port %u cannot offload the UDP checksum, "
+				   "computing it in software\n", port);
+			udp_cksum = UDP_CKSUM_SW;
+		}
+	}
 
 	/* Configure the Ethernet device. */
 	retval = rte_eth_dev_configure(port, rx_rings, tx_rings, &port_conf);
@@ -62,7 +244,7 @@ port_init(uint16_t port, struct rte_mempool *mbuf_pool)
 	if (retval != 0)
 		return retval;
 
-	/* Allocate and set up 1 RX queue per Ethernet port. */
+	/* Allocate and set up the RX queues, 1 unless the port receives. */
 	for (q = 0; q < rx_rings; q++)
 	{
 		retval = rte_eth_rx_queue_setup(port, q, nb_rxd,
@@ -73,7 +255,7 @@ port_init(uint16_t port, struct rte_mempool *mbuf_pool)
 
 	txconf = dev_info.default_txconf;
 	txconf.offloads = port_conf.txmode.offloads;
-	/* Allocate and set up 1 TX queue per Ethernet port. */
+	/* Allocate and set up the TX queues, 1 per worker lcore. */
 	for (q = 0; q < tx_rings; q++)
 	{
 		retval = rte_eth_tx_queue_setup(port, q, nb_txd,
@@ -118,36 +300,946 @@ void make_ethernet_header(struct rte_mbuf *buf)
 	eth_hdr->ether_type = rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4);
 }
 
-void make_ip_header(struct rte_mbuf *buf)
+void make_ip_header(struct rte_mbuf *buf, uint16_t ip_len)
 {
 	struct rte_ipv4_hdr *ip_hdr = (struct rte_ipv4_hdr *)(rte_pktmbuf_mtod(buf, char *) + sizeof(struct rte_ether_hdr));
 	ip_hdr->version_ihl = RTE_IPV4_VHL_DEF;
 	ip_hdr->type_of_service = RTE_IPV4_HDR_DSCP_MASK;
-	ip_hdr->total_length = 0x1E00 + sizeof(msg) * 16 * 16; // 30 + sizeof(msg)
+	ip_hdr->total_length = rte_cpu_to_be_16(ip_len);
 	ip_hdr->packet_id = 0;
 	ip_hdr->fragment_offset = 0;
 	ip_hdr->time_to_live = 64;
 	ip_hdr->next_proto_id = IPPROTO_UDP;
-	ip_hdr->src_addr = 0x0A50A8C0; // 192.168.80.10
-	ip_hdr->dst_addr = 0x0650A8C0; // 192.168.80.6
+	ip_hdr->src_addr = rte_cpu_to_be_32(flow_ranges[FLOW_SRC_IP].first);
+	ip_hdr->dst_addr = rte_cpu_to_be_32(flow_ranges[FLOW_DST_IP].first);
+	ip_hdr->hdr_checksum = 0;
 	ip_hdr->hdr_checksum = rte_ipv4_cksum(ip_hdr);
 }
 
-void make_udp_header(struct rte_mbuf *buf)
+void make_udp_header(struct rte_mbuf *buf, uint16_t udp_len)
 {
 	struct rte_udp_hdr *udp_hdr = (struct rte_udp_hdr *)(rte_pktmbuf_mtod(buf, char *) + sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr));
-	udp_hdr->src_port = PORT_ID;						 // source port
-	udp_hdr->dst_port = 0x901F;							 // 8080
-	udp_hdr->dgram_len = 0x0800 + sizeof(msg) * 16 * 16; // 8 + sizeof(msg)
+	udp_hdr->src_port = rte_cpu_to_be_16(flow_ranges[FLOW_SRC_PORT].first);
+	udp_hdr->dst_port = rte_cpu_to_be_16(flow_ranges[FLOW_DST_PORT].first);
+	udp_hdr->dgram_len = rte_cpu_to_be_16(udp_len);
 	udp_hdr->dgram_cksum = 0;
 }
 
-void fill_data(struct rte_mbuf *buf)
+void fill_data(struct rte_mbuf *buf, uint16_t data_len)
 {
 	char *data = (char *)(rte_pktmbuf_mtod(buf, char *) + sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_udp_hdr));
-	memcpy(data, msg, sizeof(msg));
-	buf->data_len = sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_udp_hdr) + sizeof(msg);
-	buf->pkt_len = sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_udp_hdr) + sizeof(msg);
+	for (uint16_t i = 0; i < data_len; i++)
+		data[i] = msg[i % (sizeof(msg) - 1)];
+	buf->data_len = sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_udp_hdr) + data_len;
+	buf->pkt_len = buf->data_len;
+}
+
+/* build a template of a frame of the given size, the NIC appends the FCS */
+static struct rte_mbuf *
+make_template(struct rte_mempool *mbuf_pool, uint16_t frame_size)
+{
+	uint16_t ip_len = frame_size - RTE_ETHER_CRC_LEN - sizeof(struct rte_ether_hdr);
+	uint16_t udp_len = ip_len - sizeof(struct rte_ipv4_hdr);
+	struct rte_mbuf *buf = rte_pktmbuf_alloc(mbuf_pool);
+
+	if (buf == NULL)
+		return NULL;
+	make_ethernet_header(buf);
+	make_ip_header(buf, ip_len);
+	make_udp_header(buf, udp_len);
+	fill_data(buf, udp_len - sizeof(struct rte_udp_hdr));
+
+	struct rte_ipv4_hdr *ip_hdr = rte_pktmbuf_mtod_offset(buf, struct rte_ipv4_hdr *,
+														  sizeof(struct rte_ether_hdr));
+	struct rte_udp_hdr *udp_hdr = (struct rte_udp_hdr *)(ip_hdr + 1);
+	if (latency_mode)
+	{
+		struct latency_stamp *stamp = (struct latency_stamp *)(udp_hdr + 1);
+		stamp->magic = STAMP_MAGIC;
+		stamp->tsc = 0;
+		stamp->seq = 0;
+	}
+	if (udp_cksum == UDP_CKSUM_SW)
+		udp_hdr->dgram_cksum = rte_ipv4_udptcp_cksum(ip_hdr, udp_hdr);
+	else if (udp_cksum == UDP_CKSUM_HW)
+	{
+		/* the NIC wants the checksum of the pseudo header to start from */
+		buf->ol_flags |= PKT_TX_IPV4 | PKT_TX_UDP_CKSUM;
+		buf->l2_len = sizeof(struct rte_ether_hdr);
+		buf->l3_len = sizeof(struct rte_ipv4_hdr);
+		udp_hdr->dgram_cksum = rte_ipv4_phdr_cksum(ip_hdr, buf->ol_flags);
+	}
+	return buf;
+}
+
+/* parse the frame sizes, "<size>[:<weight>],..." or "imix", into the
+ * pattern the templates are sent in.  the sizes are interleaved by smooth
+ * weighted round robin, so that 7:4:1 does not send 7 small frames in a
+ * row.  returns -1 if the sizes are invalid. */
+static int
+parse_sizes(const char *spec)
+{
+	uint16_t sizes[MAX_TEMPLATES];
+	int weights[MAX_TEMPLATES], current[MAX_TEMPLATES];
+	int nb_sizes = 0, total = 0;
+	char *end;
+
+	if (strcmp(spec, "imix") == 0)
+		spec = IMIX_SPEC;
+
+	while (*spec != '\0')
+	{
+		unsigned long size = strtoul(spec, &end, 10);
+		unsigned long weight = 1;
+
+		if (end == spec || size < RTE_ETHER_MIN_LEN || size > RTE_ETHER_MAX_LEN)
+			return -1;
+		if (*end == ':')
+		{
+			spec = end + 1;
+			weight = strtoul(spec, &end, 10);
+			if (end == spec || weight == 0)
+				return -1;
+		}
+		if (nb_sizes == MAX_TEMPLATES || total + weight > MAX_TEMPLATES)
+			return -1;
+		sizes[nb_sizes] = size;
+		weights[nb_sizes] = weight;
+		current[nb_sizes] = 0;
+		nb_sizes++;
+		total += weight;
+
+		if (*end == ',')
+			end++;
+		else if (*end != '\0')
+			return -1;
+		spec = end;
+	}
+	if (nb_sizes == 0)
+		return -1;
+
+	for (pattern_len = 0; pattern_len < total; pattern_len++)
+	{
+		int best = 0;
+		for (int i = 0; i < nb_sizes; i++)
+		{
+			current[i] += weights[i];
+			if (current[i] > current[best])
+				best = i;
+		}
+		current[best] -= total;
+		pattern[pattern_len] = sizes[best];
+	}
+	return 0;
+}
+
+/* parse a rate, "<number>[k|m|g](pps|bps)", 0 for no limit.  returns -1 if
+ * it is invalid. */
+static int
+parse_rate(const char *spec)
+{
+	char *end;
+	double rate = strtod(spec, &end);
+
+	if (end == spec || rate < 0)
+		return -1;
+	switch (*end)
+	{
+	case 'k': case 'K': rate *= 1e3; end++; break;
+	case 'm': case 'M': rate *= 1e6; end++; break;
+	case 'g': case 'G': rate *= 1e9; end++; break;
+	}
+	if (strcmp(end, "bps") == 0)
+		rate_in_bits = 1;
+	else if (strcmp(end, "pps") == 0 || (*end == '\0' && rate == 0))
+		rate_in_bits = 0;
+	else
+		return -1;
+	tx_rate = rate;
+	return 0;
+}
+
+/* parse the range of a field of the 5-tuple, "<first>[-<last>]" of
+ * addresses in dotted decimal or of ports.  returns -1 if it is invalid. */
+static int
+parse_range(const char *spec, int field)
+{
+	uint32_t bounds[2];
+	char buf[INET_ADDRSTRLEN * 2];
+	char *last, *end;
+
+	if (strlen(spec) >= sizeof(buf))
+		return -1;
+	strcpy(buf, spec);
+	last = strchr(buf, '-');
+	if (last != NULL)
+		*last++ = '\0';
+	else
+		last = buf;
+
+	const char *ends[2] = {buf, last};
+	for (int i = 0; i < 2; i++)
+	{
+		if (field == FLOW_SRC_IP || field == FLOW_DST_IP)
+		{
+			struct in_addr addr;
+			if (inet_pton(AF_INET, ends[i], &addr) != 1)
+				return -1;
+			bounds[i] = rte_be_to_cpu_32(addr.s_addr);
+		}
+		else
+		{
+			unsigned long port = strtoul(ends[i], &end, 10);
+			if (end == ends[i] || *end != '\0' || port > UINT16_MAX)
+				return -1;
+			bounds[i] = port;
+		}
+	}
+	/* a range of all the addresses has 2^32 of them, one short */
+	if (bounds[1] < bounds[0] || bounds[1] - bounds[0] == UINT32_MAX)
+		return -1;
+	flow_ranges[field].first = bounds[0];
+	flow_ranges[field].count = bounds[1] - bounds[0] + 1;
+	return 0;
+}
+
+static void
+usage(const char *prgname)
+{
+	printf("%s [EAL options] -- [-p PORT] [-s SIZES] [-r RATE] [-b BURST]\n"
+		   "\t\t[-t SECONDS] [-T SECONDS] [--src-ip=RANGE] [--dst-ip=RANGE]\n"
+		   "\t\t[--src-port=RANGE] [--dst-port=RANGE] [-c hw|sw] [-L] [-R PORT]\n"
+		   "\t\t[--ring-pair]\n"
+		   "  -p, --port=PORT       port to send on (default %u)\n"
+		   "  -s, --size=SIZES      frame sizes with the FCS, <size>[:<weight>],...\n"
+		   "                        or imix for " IMIX_SPEC " (default 64)\n"
+		   "  -r, --rate=RATE       rate of the port, e.g. 10Mpps or 5Gbps on the wire,\n"
+		   "                        0 for as fast as possible (default)\n"
+		   "  -b, --burst=BURST     packets per rte_eth_tx_burst() (default %u)\n"
+		   "  -t, --duration=SECS   stop after SECS, 0 for until interrupted (default)\n"
+		   "  -T, --period=SECS     statistics period (default 1)\n"
+		   "  --src-ip=A.B.C.D[-A.B.C.D], --dst-ip=A.B.C.D[-A.B.C.D]\n"
+		   "  --src-port=PORT[-PORT], --dst-port=PORT[-PORT]\n"
+		   "                        the flows sent, every combination of the ranges\n"
+		   "                        (default 192.168.80.10:%u to 192.168.80.6:8080)\n"
+		   "  -c, --udp-cksum=hw|sw fill in the UDP checksum, offloaded to the NIC\n"
+		   "                        or computed by the generator (default 0)\n"
+		   "  -L, --latency         stamp the packets and receive them back on the\n"
+		   "                        port, report the loss, reordering and latency\n"
+		   "  -R, --reflect=PORT    bounce the packets received on PORT back, alone\n"
+		   "                        or with --latency on another port\n"
+		   "  --ring-pair           make two ring ports wired to each other\n"
+		   "one TX queue, and RX queue if the port receives, is set up for every\n"
+		   "worker lcore.\n",
+		   prgname, PORT_ID, BURST_SIZE, PORT_ID);
+}
+
+static int
+parse_args(int argc, char **argv)
+{
+	static const struct option longopts[] = {
+		{"port", required_argument, NULL, 'p'},
+		{"size", required_argument, NULL, 's'},
+		{"rate", required_argument, NULL, 'r'},
+		{"burst", required_argument, NULL, 'b'},
+		{"duration", required_argument, NULL, 't'},
+		{"period", required_argument, NULL, 'T'},
+		{"src-port", required_argument, NULL, 256 + FLOW_SRC_PORT},
+		{"src-ip", required_argument, NULL, 256 + FLOW_SRC_IP},
+		{"dst-ip", required_argument, NULL, 256 + FLOW_DST_IP},
+		{"dst-port", required_argument, NULL, 256 + FLOW_DST_PORT},
+		{"udp-cksum", required_argument, NULL, 'c'},
+		{"latency", no_argument, NULL, 'L'},
+		{"reflect", required_argument, NULL, 'R'},
+		{"ring-pair", no_argument, &ring_pair, 1},
+		{NULL, 0, NULL, 0}};
+	const char *prgname = argv[0];
+	int opt;
+
+	parse_sizes("64");
+	while ((opt = getopt_long(argc, argv, "p:s:r:b:t:T:c:LR:", longopts, NULL)) != EOF)
+	{
+		switch (opt)
+		{
+		case 'p':
+			portid = atoi(optarg);
+			break;
+		case 's':
+			if (parse_sizes(optarg) < 0)
+			{
+				printf("invalid --size\n");
+				return -1;
+			}
+			break;
+		case 'r':
+			if (parse_rate(optarg) < 0)
+			{
+				printf("invalid --rate\n");
+				return -1;
+			}
+			break;
+		case 'b':
+			burst_size = atoi(optarg);
+			if (burst_size == 0 || burst_size > MAX_BURST)
+			{
+				printf("invalid --burst\n");
+				return -1;
+			}
+			break;
+		case 't':
+			duration = atof(optarg);
+			if (duration < 0)
+			{
+				printf("invalid --duration\n");
+				return -1;
+			}
+			break;
+		case 'T':
+			stats_period = atof(optarg);
+			if (stats_period <= 0)
+			{
+				printf("invalid --period\n");
+				return -1;
+			}
+			break;
+		case 'c':
+			if (strcmp(optarg, "hw") == 0)
+				udp_cksum = UDP_CKSUM_HW;
+			else if (strcmp(optarg, "sw") == 0)
+				udp_cksum = UDP_CKSUM_SW;
+			else
+			{
+				printf("invalid --udp-cksum\n");
+				return -1;
+			}
+			break;
+		case 'L':
+			latency_mode = 1;
+			break;
+		case 'R':
+			reflect_port = atoi(optarg);
+			break;
+		case 0:
+			break;
+		case 256 + FLOW_SRC_PORT:
+		case 256 + FLOW_SRC_IP:
+		case 256 + FLOW_DST_IP:
+		case 256 + FLOW_DST_PORT:
+			if (parse_range(optarg, opt - 256) < 0)
+			{
+				printf("invalid --%s\n", flow_options[opt - 256]);
+				return -1;
+			}
+			break;
+		default:
+			usage(prgname);
+			return -1;
+		}
+	}
+
+	for (int i = 0; i < FLOW_FIELDS; i++)
+		if (flow_ranges[i].count > 1)
+			flow_mode = 1;
+	return 0;
+}
+
+static void
+signal_handler(int signum)
+{
+	if (signum == SIGINT || signum == SIGTERM)
+		force_quit = 1;
+}
+
+/* move the flow of a queue on by the given number of flows, the offsets in
+ * the ranges carry over like the digits of a number */
+static inline void
+advance_flow(uint32_t *flow, uint32_t step)
+{
+	uint64_t carry = step;
+
+	for (int i = 0; i < FLOW_FIELDS && carry > 0; i++)
+	{
+		uint64_t offset = flow[i] + carry;
+		carry = offset / flow_ranges[i].count;
+		flow[i] = offset % flow_ranges[i].count;
+	}
+}
+
+/* patch the next flows of a queue into the templates of a burst.  only the
+ * addresses and the ports are written, and the checksums are updated for
+ * the words that changed as in RFC 1624, HC' = ~(~HC + ~m + m').  the sums
+ * are over the 16-bit words as they are in memory, one's complement
+ * addition does not mind their byte order.  the checksums of the whole
+ * burst are computed together in loops over arrays without branches, which
+ * the compiler vectorises. */
+static void
+patch_flows(struct tx_queue *txq, struct rte_mbuf **bufs, uint16_t n)
+{
+	struct rte_ipv4_hdr *ip_hdr[MAX_BURST];
+	struct rte_udp_hdr *udp_hdr[MAX_BURST];
+	uint32_t src_addr[MAX_BURST], dst_addr[MAX_BURST];
+	uint32_t old_src_addr[MAX_BURST], old_dst_addr[MAX_BURST];
+	uint16_t src_port[MAX_BURST], dst_port[MAX_BURST];
+	uint16_t old_src_port[MAX_BURST], old_dst_port[MAX_BURST];
+	uint16_t ip_cksum[MAX_BURST], l4_cksum[MAX_BURST];
+	uint32_t addr_sum[MAX_BURST];
+	uint16_t i;
+
+	for (i = 0; i < n; i++)
+	{
+		uint32_t *flow = txq->flow;
+
+		ip_hdr[i] = rte_pktmbuf_mtod_offset(bufs[i], struct rte_ipv4_hdr *,
+											sizeof(struct rte_ether_hdr));
+		udp_hdr[i] = (struct rte_udp_hdr *)(ip_hdr[i] + 1);
+		src_addr[i] = rte_cpu_to_be_32(flow_ranges[FLOW_SRC_IP].first + flow[FLOW_SRC_IP]);
+		dst_addr[i] = rte_cpu_to_be_32(flow_ranges[FLOW_DST_IP].first + flow[FLOW_DST_IP]);
+		src_port[i] = rte_cpu_to_be_16(flow_ranges[FLOW_SRC_PORT].first + flow[FLOW_SRC_PORT]);
+		dst_port[i] = rte_cpu_to_be_16(flow_ranges[FLOW_DST_PORT].first + flow[FLOW_DST_PORT]);
+		old_src_addr[i] = ip_hdr[i]->src_addr;
+		old_dst_addr[i] = ip_hdr[i]->dst_addr;
+		old_src_port[i] = udp_hdr[i]->src_port;
+		old_dst_port[i] = udp_hdr[i]->dst_port;
+		ip_cksum[i] = ip_hdr[i]->hdr_checksum;
+		l4_cksum[i] = udp_hdr[i]->dgram_cksum;
+		advance_flow(flow, nb_tx_queues);
+	}
+
+	/* the change of the addresses, which both checksums cover */
+	for (i = 0; i < n; i++)
+		addr_sum[i] = (uint16_t)~old_src_addr[i] + (uint16_t)~(old_src_addr[i] >> 16) +
+					  (src_addr[i] & 0xffff) + (src_addr[i] >> 16) +
+					  (uint16_t)~old_dst_addr[i] + (uint16_t)~(old_dst_addr[i] >> 16) +
+					  (dst_addr[i] & 0xffff) + (dst_addr[i] >> 16);
+
+	for (i = 0; i < n; i++)
+	{
+		uint32_t sum = (uint16_t)~ip_cksum[i] + addr_sum[i];
+		sum = (sum & 0xffff) + (sum >> 16);
+		sum = (sum & 0xffff) + (sum >> 16);
+		ip_cksum[i] = ~sum;
+	}
+
+	if (udp_cksum == UDP_CKSUM_SW)
+	{
+		/* the UDP checksum covers the ports too, and 0 is sent as
+		 * 0xffff, 0 is for no checksum */
+		for (i = 0; i < n; i++)
+		{
+			uint32_t sum = (uint16_t)~l4_cksum[i] + addr_sum[i] +
+						   (uint16_t)~old_src_port[i] + src_port[i] +
+						   (uint16_t)~old_dst_port[i] + dst_port[i];
+			sum = (sum & 0xffff) + (sum >> 16);
+			sum = (sum & 0xffff) + (sum >> 16);
+			sum = (uint16_t)~sum;
+			l4_cksum[i] = sum == 0 ? 0xffff : sum;
+		}
+	}
+	else if (udp_cksum == UDP_CKSUM_HW)
+	{
+		/* the NIC starts from the sum of the pseudo header, which is not
+		 * complemented */
+		for (i = 0; i < n; i++)
+		{
+			uint32_t sum = l4_cksum[i] + addr_sum[i];
+			sum = (sum & 0xffff) + (sum >> 16);
+			sum = (sum & 0xffff) + (sum >> 16);
+			l4_cksum[i] = sum;
+		}
+	}
+
+	for (i = 0; i < n; i++)
+	{
+		ip_hdr[i]->src_addr = src_addr[i];
+		ip_hdr[i]->dst_addr = dst_addr[i];
+		ip_hdr[i]->hdr_checksum = ip_cksum[i];
+		udp_hdr[i]->src_port = src_port[i];
+		udp_hdr[i]->dst_port = dst_port[i];
+		udp_hdr[i]->dgram_cksum = l4_cksum[i];
+	}
+}
+
+/* build the templates of a queue in the size pattern and set up its token
+ * bucket, the rate of the port is shared evenly by the queues.  in flow
+ * and latency mode a queue has a template for every packet the PMD may not
+ * have freed yet, and sends every nb_tx_queues-th flow from the one of its
+ * queue id. */
+static int
+tx_queue_init(struct tx_queue *txq, struct rte_mempool *mbuf_pool)
+{
+	double max_cost = 0;
+
+	txq->nb_templates = pattern_len;
+	if (own_templates)
+		txq->nb_templates = (FLOW_SLOTS + pattern_len - 1) / pattern_len * pattern_len;
+	txq->templates = rte_zmalloc(NULL, txq->nb_templates * sizeof(*txq->templates), 0);
+	txq->cost = rte_zmalloc(NULL, txq->nb_templates * sizeof(*txq->cost), 0);
+	if (txq->templates == NULL || txq->cost == NULL)
+		return -1;
+
+	for (uint16_t i = 0; i < txq->nb_templates; i++)
+	{
+		uint16_t size = pattern[i % pattern_len];
+		txq->templates[i] = make_template(mbuf_pool, size);
+		if (txq->templates[i] == NULL)
+			return -1;
+		txq->cost[i] = rate_in_bits ? (size + WIRE_OVERHEAD) * 8.0 : 1.0;
+		if (txq->cost[i] > max_cost)
+			max_cost = txq->cost[i];
+	}
+	advance_flow(txq->flow, txq->queue_id);
+
+	/* the bucket holds a burst, a queue that fell behind does not catch
+	 * up with more than that at once */
+	txq->tokens_per_cycle = tx_rate / nb_tx_queues / rte_get_tsc_hz();
+	txq->bucket_depth = max_cost * burst_size;
+	txq->tokens = 0;
+	txq->last = rte_rdtsc();
+	return 0;
+}
+
+/* the counters of an RX queue by TX queue */
+static int
+rx_queue_init(struct rx_queue *rxq)
+{
+	rxq->received_from = rte_zmalloc(NULL, nb_tx_queues * sizeof(uint64_t), 0);
+	rxq->next_seq = rte_zmalloc(NULL, nb_tx_queues * sizeof(uint64_t), 0);
+	if (rxq->received_from == NULL || rxq->next_seq == NULL)
+		return -1;
+	return 0;
+}
+
+/* stamp the sequence numbers and the TSC into a burst, the UDP checksum is
+ * updated like in patch_flows() for the words of the stamp that change */
+static void
+stamp_packets(struct tx_queue *txq, struct rte_mbuf **bufs, uint16_t n)
+{
+	uint64_t now = rte_rdtsc();
+
+	for (uint16_t i = 0; i < n; i++)
+	{
+		struct rte_udp_hdr *udp_hdr = rte_pktmbuf_mtod_offset(bufs[i], struct rte_udp_hdr *,
+															  sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr));
+		struct latency_stamp *stamp = (struct latency_stamp *)(udp_hdr + 1);
+		uint64_t seq = (uint64_t)txq->queue_id << STAMP_QUEUE_SHIFT | (txq->seq + i);
+
+		if (udp_cksum == UDP_CKSUM_SW)
+		{
+			uint64_t old[2] = {stamp->tsc, stamp->seq}, new[2] = {now, seq};
+			uint32_t sum = (uint16_t)~udp_hdr->dgram_cksum;
+			for (int w = 0; w < 2; w++)
+				for (int shift = 0; shift < 64; shift += 16)
+					sum += (uint16_t)~(old[w] >> shift) + (uint16_t)(new[w] >> shift);
+			sum = (sum & 0xffff) + (sum >> 16);
+			sum = (sum & 0xffff) + (sum >> 16);
+			sum = (uint16_t)~sum;
+			udp_hdr->dgram_cksum = sum == 0 ? 0xffff : sum;
+		}
+		stamp->tsc = now;
+		stamp->seq = seq;
+	}
+}
+
+/* send a burst on the TX queue of a worker lcore */
+static void
+send_burst(struct tx_queue *txq)
+{
+	struct rte_mbuf *bufs[MAX_BURST];
+	uint16_t n = 0, nb_tx;
+	uint64_t bytes = 0;
+
+	if (tx_rate > 0)
+	{
+		uint64_t now = rte_rdtsc();
+		txq->tokens += (now - txq->last) * txq->tokens_per_cycle;
+		if (txq->tokens > txq->bucket_depth)
+			txq->tokens = txq->bucket_depth;
+		txq->last = now;
+	}
+
+	/* as many packets of the pattern as the tokens pay for */
+	while (n < burst_size)
+	{
+		struct rte_mbuf *m = txq->templates[txq->next];
+
+		/* a template the PMD still has */
+		if (own_templates && rte_mbuf_refcnt_read(m) > 1)
+			break;
+		if (tx_rate > 0)
+		{
+			if (txq->tokens < txq->cost[txq->next])
+				break;
+			txq->tokens -= txq->cost[txq->next];
+		}
+		rte_mbuf_refcnt_update(m, 1);
+		bufs[n++] = m;
+		if (++txq->next == txq->nb_templates)
+			txq->next = 0;
+	}
+	if (n == 0)
+		return;
+	if (flow_mode && n > txq->ready)
+		patch_flows(txq, bufs + txq->ready, n - txq->ready);
+	if (latency_mode)
+		stamp_packets(txq, bufs, n);
+
+	nb_tx = rte_eth_tx_burst(portid, txq->queue_id, bufs, n);
+	txq->seq += nb_tx;
+
+	/* the packets the ring had no room for are sent again next time, in
+	 * the same order and with the same flows */
+	txq->ready = RTE_MAX(txq->ready, n) - nb_tx;
+	for (uint16_t i = nb_tx; i < n; i++)
+	{
+		if (txq->next == 0)
+			txq->next = txq->nb_templates;
+		txq->next--;
+		if (tx_rate > 0)
+			txq->tokens += txq->cost[txq->next];
+		rte_mbuf_refcnt_update(bufs[i], -1);
+	}
+
+	for (uint16_t i = 0; i < nb_tx; i++)
+		bytes += bufs[i]->pkt_len + RTE_ETHER_CRC_LEN;
+	__atomic_store_n(&txq->pkts, txq->pkts + nb_tx, __ATOMIC_RELAXED);
+	__atomic_store_n(&txq->bytes, txq->bytes + bytes, __ATOMIC_RELAXED);
+	__atomic_store_n(&txq->unsent, txq->unsent + (n - nb_tx), __ATOMIC_RELAXED);
+}
+
+/* the bucket of a latency */
+static inline int
+latency_index(uint64_t value)
+{
+	if (value < LAT_SUB_BUCKETS)
+		return value;
+	int shift = 63 - __builtin_clzll(value) - LAT_SUB_BITS + 1;
+	return shift * (LAT_SUB_BUCKETS / 2) + (value >> shift);
+}
+
+/* the lowest latency of a bucket */
+static inline uint64_t
+latency_lowest(int i)
+{
+	if (i < LAT_SUB_BUCKETS)
+		return i;
+	int shift = i / (LAT_SUB_BUCKETS / 2) - 1;
+	return (uint64_t)(i % (LAT_SUB_BUCKETS / 2) + LAT_SUB_BUCKETS / 2) << shift;
+}
+
+/* the stamp of a packet of the generator, NULL if it is not one */
+static inline const struct latency_stamp *
+find_stamp(struct rte_mbuf *m)
+{
+	const struct rte_ether_hdr *eth_hdr = rte_pktmbuf_mtod(m, struct rte_ether_hdr *);
+	const struct rte_ipv4_hdr *ip_hdr = (const struct rte_ipv4_hdr *)(eth_hdr + 1);
+	const struct latency_stamp *stamp;
+
+	if (rte_pktmbuf_data_len(m) < sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) +
+									  sizeof(struct rte_udp_hdr) + sizeof(struct latency_stamp) ||
+		eth_hdr->ether_type != rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4) ||
+		ip_hdr->version_ihl != RTE_IPV4_VHL_DEF || ip_hdr->next_proto_id != IPPROTO_UDP)
+		return NULL;
+	stamp = (const struct latency_stamp *)((const struct rte_udp_hdr *)(ip_hdr + 1) + 1);
+	if (stamp->magic != STAMP_MAGIC || (stamp->seq >> STAMP_QUEUE_SHIFT) >= nb_tx_queues)
+		return NULL;
+	return stamp;
+}
+
+/* receive a burst on the RX queue of a worker lcore in latency mode and
+ * match the stamps */
+static void
+receive_burst(uint16_t queue_id)
+{
+	struct rx_queue *rxq = &rx_queues[queue_id];
+	struct rte_mbuf *bufs[MAX_BURST];
+	uint16_t nb_rx = rte_eth_rx_burst(portid, queue_id, bufs, burst_size);
+	uint64_t now = rte_rdtsc();
+	uint64_t pkts = 0, reordered = 0;
+
+	for (uint16_t i = 0; i < nb_rx; i++)
+	{
+		const struct latency_stamp *stamp = find_stamp(bufs[i]);
+		if (stamp == NULL)
+			continue;
+
+		uint16_t from = stamp->seq >> STAMP_QUEUE_SHIFT;
+		uint64_t seq = stamp->seq & ((1ULL << STAMP_QUEUE_SHIFT) - 1);
+		uint64_t latency = now - stamp->tsc;
+
+		rxq->received_from[from]++;
+		if (seq >= rxq->next_seq[from])
+			rxq->next_seq[from] = seq + 1;
+		else
+			reordered++;
+		rxq->latency[latency_index(latency)]++;
+		if (rxq->pkts + pkts == 0 || latency < rxq->lat_min)
+			rxq->lat_min = latency;
+		if (latency > rxq->lat_max)
+			rxq->lat_max = latency;
+		rxq->lat_sum += latency;
+		pkts++;
+	}
+	if (nb_rx > 0)
+		rte_pktmbuf_free_bulk(bufs, nb_rx);
+
+	__atomic_store_n(&rxq->pkts, rxq->pkts + pkts, __ATOMIC_RELAXED);
+	__atomic_store_n(&rxq->reordered, rxq->reordered + reordered, __ATOMIC_RELAXED);
+}
+
+/* bounce back a burst received on the reflect port with the MAC and IP
+ * addresses and the UDP ports swapped, which leaves the checksums as they
+ * are.  a packet still referenced elsewhere, a template of the generator
+ * of this process over a ring pair, is copied first. */
+static void
+reflect_burst(uint16_t queue_id)
+{
+	struct rx_queue *rxq = &rx_queues[queue_id];
+	struct rte_mbuf *bufs[MAX_BURST];
+	uint16_t nb_rx = rte_eth_rx_burst(reflect_port, queue_id, bufs, burst_size);
+	uint16_t n = 0, nb_tx;
+
+	if (nb_rx == 0)
+		return;
+	for (uint16_t i = 0; i < nb_rx; i++)
+	{
+		struct rte_mbuf *m = bufs[i];
+
+		if (rte_mbuf_refcnt_read(m) > 1)
+		{
+			m = rte_pktmbuf_copy(bufs[i], mbuf_pool, 0, UINT32_MAX);
+			rte_pktmbuf_free(bufs[i]);
+			if (m == NULL)
+				continue;
+		}
+
+		struct rte_ether_hdr *eth_hdr = rte_pktmbuf_mtod(m, struct rte_ether_hdr *);
+		struct rte_ether_addr eth_addr = eth_hdr->d_addr;
+		eth_hdr->d_addr = eth_hdr->s_addr;
+		eth_hdr->s_addr = eth_addr;
+		if (eth_hdr->ether_type == rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4))
+		{
+			struct rte_ipv4_hdr *ip_hdr = (struct rte_ipv4_hdr *)(eth_hdr + 1);
+			uint32_t ip_addr = ip_hdr->src_addr;
+			ip_hdr->src_addr = ip_hdr->dst_addr;
+			ip_hdr->dst_addr = ip_addr;
+			if (ip_hdr->next_proto_id == IPPROTO_UDP)
+			{
+				struct rte_udp_hdr *udp_hdr = (struct rte_udp_hdr *)
+					((char *)ip_hdr + rte_ipv4_hdr_len(ip_hdr));
+				uint16_t udp_port = udp_hdr->src_port;
+				udp_hdr->src_port = udp_hdr->dst_port;
+				udp_hdr->dst_port = udp_port;
+			}
+		}
+		bufs[n++] = m;
+	}
+
+	nb_tx = rte_eth_tx_burst(reflect_port, queue_id, bufs, n);
+	if (nb_tx < n)
+		rte_pktmbuf_free_bulk(bufs + nb_tx, n - nb_tx);
+	__atomic_store_n(&rxq->reflected, rxq->reflected + nb_tx, __ATOMIC_RELAXED);
+	__atomic_store_n(&rxq->dropped, rxq->dropped + (nb_rx - nb_tx), __ATOMIC_RELAXED);
+}
+
+/* the loop of a worker lcore: send on its TX queue, and receive the
+ * packets back or bounce them back on the RX queues of the same number.
+ * the receivers go on for a while after the generator stops. */
+static int
+lcore_main(void *arg)
+{
+	struct tx_queue *txq = arg;
+	uint16_t q = txq->queue_id;
+
+	if (generate)
+		printf("lcore %u sends on queue %u\n", rte_lcore_id(), q);
+	if (reflect_port >= 0)
+		printf("lcore %u reflects on queue %u of port %d\n", rte_lcore_id(), q, reflect_port);
+
+	while (!rx_quit)
+	{
+		if (generate && !force_quit)
+			send_burst(txq);
+		if (latency_mode)
+			receive_burst(q);
+		if (reflect_port >= 0)
+			reflect_burst(q);
+	}
+	return 0;
+}
+
+/* print the rate of every queue and of the port over the last period */
+static void
+print_rates(double elapsed, double interval)
+{
+	static uint64_t last_pkts[RTE_MAX_LCORE], last_bytes[RTE_MAX_LCORE];
+	static uint64_t last_rx[RTE_MAX_LCORE], last_reflected[RTE_MAX_LCORE];
+	uint64_t total_pkts = 0, total_bytes = 0, total_unsent = 0;
+	uint64_t total_sent = 0, total_rx = 0, total_reordered = 0;
+
+	for (uint16_t q = 0; q < nb_tx_queues && generate; q++)
+	{
+		struct tx_queue *txq = &tx_queues[q];
+		uint64_t pkts = __atomic_load_n(&txq->pkts, __ATOMIC_RELAXED);
+		uint64_t bytes = __atomic_load_n(&txq->bytes, __ATOMIC_RELAXED);
+		uint64_t unsent = __atomic_load_n(&txq->unsent, __ATOMIC_RELAXED);
+		uint64_t dpkts = pkts - last_pkts[q], dbytes = bytes - last_bytes[q];
+
+		printf("[%7.2fs] queue %-3u %9.3f Mpps %8.3f Gbps %" PRIu64 " unsent\n",
+			   elapsed, q, dpkts / interval / 1e6,
+			   (dbytes + dpkts * WIRE_OVERHEAD) * 8.0 / interval / 1e9, unsent);
+		total_pkts += dpkts;
+		total_bytes += dbytes;
+		total_unsent += unsent;
+		total_sent += pkts;
+		last_pkts[q] = pkts;
+		last_bytes[q] = bytes;
+	}
+	if (generate && nb_tx_queues > 1)
+		printf("[%7.2fs] port %-4u %9.3f Mpps %8.3f Gbps %" PRIu64 " unsent\n",
+			   elapsed, portid, total_pkts / interval / 1e6,
+			   (total_bytes + total_pkts * WIRE_OVERHEAD) * 8.0 / interval / 1e9,
+			   total_unsent);
+
+	for (uint16_t q = 0; q < nb_tx_queues && latency_mode; q++)
+	{
+		struct rx_queue *rxq = &rx_queues[q];
+		uint64_t pkts = __atomic_load_n(&rxq->pkts, __ATOMIC_RELAXED);
+		uint64_t reordered = __atomic_load_n(&rxq->reordered, __ATOMIC_RELAXED);
+
+		printf("[%7.2fs] queue %-3u %9.3f Mpps back %" PRIu64 " reordered\n",
+			   elapsed, q, (pkts - last_rx[q]) / interval / 1e6, reordered);
+		total_rx += pkts;
+		total_reordered += reordered;
+		last_rx[q] = pkts;
+	}
+	if (latency_mode)
+		printf("[%7.2fs] port %-4u %" PRIu64 " not back yet %" PRIu64 " reordered\n",
+			   elapsed, portid, total_sent - total_rx, total_reordered);
+
+	for (uint16_t q = 0; q < nb_tx_queues && reflect_port >= 0; q++)
+	{
+		struct rx_queue *rxq = &rx_queues[q];
+		uint64_t reflected = __atomic_load_n(&rxq->reflected, __ATOMIC_RELAXED);
+		uint64_t dropped = __atomic_load_n(&rxq->dropped, __ATOMIC_RELAXED);
+
+		printf("[%7.2fs] queue %-3u %9.3f Mpps reflected %" PRIu64 " dropped\n",
+			   elapsed, q, (reflected - last_reflected[q]) / interval / 1e6, dropped);
+		last_reflected[q] = reflected;
+	}
+}
+
+/* the latency a fraction p of the latencies recorded are at or below, as
+ * the highest latency of its bucket */
+static uint64_t
+latency_percentile(const uint64_t *latency, uint64_t total, uint64_t max, double p)
+{
+	uint64_t rank = p * total + 0.5, seen = 0;
+
+	if (rank < 1)
+		rank = 1;
+	for (int i = 0; i < LAT_BUCKETS; i++)
+	{
+		seen += latency[i];
+		if (seen >= rank)
+			return RTE_MIN(latency_lowest(i + 1) - 1, max);
+	}
+	return max;
+}
+
+static void
+print_latency_line(const char *what, unsigned int id, const uint64_t *latency,
+				   uint64_t total, uint64_t min, uint64_t max, double sum)
+{
+	double us = 1e6 / rte_get_tsc_hz();
+
+	if (total == 0)
+	{
+		printf("%s %-*u no packets back\n", what, (int)(8 - strlen(what)), id);
+		return;
+	}
+	printf("%s %-*u latency (us) min %.2f mean %.2f p50 %.2f p99 %.2f p99.9 %.2f max %.2f\n",
+		   what, (int)(8 - strlen(what)), id, min * us, sum / total * us,
+		   latency_percentile(latency, total, max, 0.5) * us,
+		   latency_percentile(latency, total, max, 0.99) * us,
+		   latency_percentile(latency, total, max, 0.999) * us, max * us);
+}
+
+/* the loss of every TX queue, and the reordering and the latencies seen by
+ * every RX queue, once the receivers have stopped */
+static void
+print_latency(void)
+{
+	static uint64_t latency[LAT_BUCKETS];
+	uint64_t sent = 0, back = 0, reordered = 0, recorded = 0;
+	uint64_t min = 0, max = 0;
+	double sum = 0;
+
+	for (uint16_t q = 0; q < nb_tx_queues; q++)
+	{
+		uint64_t received = 0;
+		for (uint16_t r = 0; r < nb_tx_queues; r++)
+			received += rx_queues[r].received_from[q];
+		printf("queue %-3u sent %" PRIu64 " back %" PRIu64 " lost %" PRIu64 " (%.4f%%)\n",
+			   q, tx_queues[q].pkts, received, tx_queues[q].pkts - received,
+			   tx_queues[q].pkts ? 100.0 * (tx_queues[q].pkts - received) / tx_queues[q].pkts : 0.0);
+		sent += tx_queues[q].pkts;
+		back += received;
+	}
+
+	for (uint16_t r = 0; r < nb_tx_queues; r++)
+	{
+		struct rx_queue *rxq = &rx_queues[r];
+
+		printf("queue %-3u reordered %" PRIu64 " of %" PRIu64 "\n", r, rxq->reordered, rxq->pkts);
+		print_latency_line("queue", r, rxq->latency, rxq->pkts,
+						   rxq->lat_min, rxq->lat_max, rxq->lat_sum);
+		for (int i = 0; i < LAT_BUCKETS; i++)
+			latency[i] += rxq->latency[i];
+		if (rxq->pkts > 0 && (recorded == 0 || rxq->lat_min < min))
+			min = rxq->lat_min;
+		recorded += rxq->pkts;
+		max = RTE_MAX(max, rxq->lat_max);
+		sum += rxq->lat_sum;
+		reordered += rxq->reordered;
+	}
+
+	printf("port %-4u sent %" PRIu64 " back %" PRIu64 " lost %" PRIu64 " (%.4f%%) reordered %" PRIu64 "\n",
+		   portid, sent, back, sent - back, sent ? 100.0 * (sent - back) / sent : 0.0, reordered);
+	print_latency_line("port", portid, latency, back, min, max, sum);
+}
+
+/* make two ports of rings wired to each other, TX queue q of each port is
+ * RX queue q of the other, to test the latency mode without NICs */
+static int
+make_ring_pair(void)
+{
+	struct rte_ring *a_to_b[RTE_PMD_RING_MAX_RX_RINGS], *b_to_a[RTE_PMD_RING_MAX_RX_RINGS];
+	char name[RTE_RING_NAMESIZE];
+	int a, b;
+
+	if (nb_tx_queues > RTE_PMD_RING_MAX_RX_RINGS)
+	{
+		printf("A ring pair has at most %u queues\n", RTE_PMD_RING_MAX_RX_RINGS);
+		return -1;
+	}
+	for (uint16_t q = 0; q < nb_tx_queues; q++)
+	{
+		snprintf(name, sizeof(name), "RING_PAIR_AB%u", q);
+		a_to_b[q] = rte_ring_create(name, RX_RING_SIZE, rte_socket_id(),
+									RING_F_SP_ENQ | RING_F_SC_DEQ);
+		snprintf(name, sizeof(name), "RING_PAIR_BA%u", q);
+		b_to_a[q] = rte_ring_create(name, RX_RING_SIZE, rte_socket_id(),
+									RING_F_SP_ENQ | RING_F_SC_DEQ);
+		if (a_to_b[q] == NULL || b_to_a[q] == NULL)
+			return -1;
+	}
+
+	a = rte_eth_from_rings("ring_pair_a", b_to_a, nb_tx_queues, a_to_b, nb_tx_queues, rte_socket_id());
+	b = rte_eth_from_rings("ring_pair_b", a_to_b, nb_tx_queues, b_to_a, nb_tx_queues, rte_socket_id());
+	if (a < 0 || b < 0)
+		return -1;
+	printf("Ports %d and %d are a ring pair\n", a, b);
+	return 0;
 }
 
 /*
@@ -156,8 +1248,7 @@ void fill_data(struct rte_mbuf *buf)
  */
 int main(int argc, char *argv[])
 {
-	struct rte_mempool *mbuf_pool;
-	uint16_t portid = PORT_ID;
+	unsigned int lcore_id;
 
 	/* Initialize the Environment Abstraction Layer (EAL). */
 	int ret = rte_eal_init(argc, argv);
@@ -166,36 +1257,144 @@ int main(int argc, char *argv[])
 
 	argc -= ret;
 	argv += ret;
+	argv[0] = argv[-ret];
+
+	if (parse_args(argc, argv) < 0)
+		rte_exit(EXIT_FAILURE, "Invalid arguments\n");
+
+	/* every worker lcore sends on a queue of its own, the main lcore
+	 * prints the statistics */
+	nb_tx_queues = rte_lcore_count() - 1;
+	if (nb_tx_queues == 0)
+		rte_exit(EXIT_FAILURE, "At least one worker lcore is needed\n");
+
+	if (ring_pair && make_ring_pair() != 0)
+		rte_exit(EXIT_FAILURE, "Cannot make the ring pair\n");
+
+	/* a reflector alone does not send, and a port does not reflect what it
+	 * sends itself */
+	generate = reflect_port < 0 || latency_mode;
+	own_templates = flow_mode || latency_mode;
+	if (reflect_port >= 0 && (!rte_eth_dev_is_valid_port(reflect_port) ||
+							  (generate && reflect_port == portid)))
+		rte_exit(EXIT_FAILURE, "Cannot reflect on port %d\n", reflect_port);
 
 	/* Creates a new mempool in memory to hold the mbufs. */
-	mbuf_pool = rte_pktmbuf_pool_create("MBUF_POOL", NUM_MBUFS,
+	unsigned int nb_mbufs = NUM_MBUFS;
+	if (own_templates)
+		nb_mbufs += nb_tx_queues * (FLOW_SLOTS + MAX_TEMPLATES);
+	if (latency_mode)
+		nb_mbufs += nb_tx_queues * RX_RING_SIZE;
+	if (reflect_port >= 0)
+		nb_mbufs += nb_tx_queues * (RX_RING_SIZE + TX_RING_SIZE);
+	mbuf_pool = rte_pktmbuf_pool_create("MBUF_POOL", nb_mbufs,
 										MBUF_CACHE_SIZE, 0, RTE_MBUF_DEFAULT_BUF_SIZE, rte_socket_id());
 	if (mbuf_pool == NULL)
 		rte_exit(EXIT_FAILURE, "Cannot create mbuf pool\n");
 
 	/* Initialize all ports. */
-	if (port_init(portid, mbuf_pool) != 0)
-		rte_exit(EXIT_FAILURE, "Cannot init port %" PRIu8 "\n",
+	if (generate && port_init(portid, mbuf_pool, latency_mode ? nb_tx_queues : 1, nb_tx_queues) != 0)
+		rte_exit(EXIT_FAILURE, "Cannot init port %" PRIu16 "\n",
 				 portid);
+	if (reflect_port >= 0 && port_init(reflect_port, mbuf_pool, nb_tx_queues, nb_tx_queues) != 0)
+		rte_exit(EXIT_FAILURE, "Cannot init port %d\n", reflect_port);
 
-	/* Fill packages. */
-	struct rte_mbuf *bufs[BURST_SIZE];
-	for (int i = 0; i < BURST_SIZE; i++)
+	/* Build the templates. */
+	for (uint16_t q = 0; q < nb_tx_queues; q++)
 	{
-		bufs[i] = rte_pktmbuf_alloc(mbuf_pool);
-		make_ethernet_header(bufs[i]);
-		make_ip_header(bufs[i]);
-		make_udp_header(bufs[i]);
-		fill_data(bufs[i]);
+		tx_queues[q].queue_id = q;
+		if (generate && tx_queue_init(&tx_queues[q], mbuf_pool) != 0)
+			rte_exit(EXIT_FAILURE, "Cannot build the templates\n");
+		if (latency_mode && rx_queue_init(&rx_queues[q]) != 0)
+			rte_exit(EXIT_FAILURE, "Cannot allocate the RX counters\n");
+	}
+	if (flow_mode)
+	{
+		double nb_flows = 1;
+		for (int i = 0; i < FLOW_FIELDS; i++)
+			nb_flows *= flow_ranges[i].count;
+		printf("%.0f flows, %u templates per queue\n", nb_flows, tx_queues[0].nb_templates);
 	}
 
+	force_quit = 0;
+	rx_quit = 0;
+	signal(SIGINT, signal_handler);
+	signal(SIGTERM, signal_handler);
+
 	/* Send packages. */
-	uint16_t nb_tx = rte_eth_tx_burst(portid, 0, bufs, BURST_SIZE);
-	printf("send %d packages successfully.\n", nb_tx);
+	uint16_t q = 0;
+	RTE_LCORE_FOREACH_WORKER(lcore_id)
+	{
+		tx_queues[q].lcore_id = lcore_id;
+		rte_eal_remote_launch(lcore_main, &tx_queues[q], lcore_id);
+		q++;
+	}
+
+	uint64_t hz = rte_get_tsc_hz();
+	uint64_t start = rte_rdtsc(), last = start;
+	while (!force_quit)
+	{
+		rte_delay_us_sleep(10000);
+		uint64_t now = rte_rdtsc();
+		if (duration > 0 && now - start >= duration * hz)
+			force_quit = 1;
+		if (now - last >= stats_period * hz || force_quit)
+		{
+			print_rates((double)(now - start) / hz, (double)(now - last) / hz);
+			last = now;
+		}
+	}
+	double elapsed = (double)(rte_rdtsc() - start) / hz;
+	if (latency_mode || reflect_port >= 0)
+		rte_delay_us_sleep(DRAIN_US);
+	rx_quit = 1;
+	rte_eal_mp_wait_lcore();
+
+	/* Totals of the whole run. */
+	uint64_t pkts = 0, bytes = 0;
+	for (q = 0; q < nb_tx_queues; q++)
+	{
+		pkts += tx_queues[q].pkts;
+		bytes += tx_queues[q].bytes;
+	}
+	if (generate)
+		printf("send %" PRIu64 " packages in %.2fs, %.3f Mpps, %.3f Gbps on the wire.\n",
+			   pkts, elapsed, pkts / elapsed / 1e6,
+			   (bytes + pkts * WIRE_OVERHEAD) * 8.0 / elapsed / 1e9);
+	if (latency_mode)
+		print_latency();
+	if (reflect_port >= 0)
+	{
+		uint64_t reflected = 0, dropped = 0;
+		for (q = 0; q < nb_tx_queues; q++)
+		{
+			reflected += rx_queues[q].reflected;
+			dropped += rx_queues[q].dropped;
+		}
+		printf("reflect %" PRIu64 " packages, %" PRIu64 " dropped.\n", reflected, dropped);
+	}
 
-	/* Clean up. */
-	for (int i = 0; i < BURST_SIZE; i++)
-		rte_pktmbuf_free(bufs[i]);
+	/* Clean up, the PMD has dropped its references once the port stops. */
+	if (generate)
+	{
+		rte_eth_dev_stop(portid);
+		rte_eth_dev_close(portid);
+	}
+	if (reflect_port >= 0)
+	{
+		rte_eth_dev_stop(reflect_port);
+		rte_eth_dev_close(reflect_port);
+	}
+	for (q = 0; q < nb_tx_queues; q++)
+	{
+		for (uint16_t i = 0; i < tx_queues[q].nb_templates; i++)
+			rte_pktmbuf_free(tx_queues[q].templates[i]);
+		rte_free(tx_queues[q].templates);
+		rte_free(tx_queues[q].cost);
+		rte_free(rx_queues[q].received_from);
+		rte_free(rx_queues[q].next_seq);
+	}
+	rte_eal_cleanup();
 
 	return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,470 @@
+/*
+ * FILE: rdt_bench.cc
+ * DESCRIPTION: Micro-benchmarks of the hot paths of the rdt layer.
+ * NOTE: The sender, the receiver, the checksums and the event chain are run
+ *       in isolation, with the routines the simulator provides replaced by
+ *       stubs that only count.  The packets they are fed are recorded from a
+ *       transfer between the real sender and receiver, so the benchmarks
+ *       follow any change of the packet formats, and a benchmark fails if
+ *       the rdt layer stops delivering or sending.  Google Benchmark reports
+ *       the time per operation, the allocs/op counter is the number of
+ *       malloc/calloc/realloc calls made by the rdt layer and the event chain
+ *       plus every operator new, per operation.
+ *
+ *       usage: rdt_bench [--benchmark_filter=<regex>] [<google benchmark flags>]
+ *
+ *       It needs Google Benchmark, build it with "make rdt_bench".
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include <string>
+#include <vector>
+#include <benchmark/benchmark.h>
+
+#include "rdt_struct.h"
+#include "rdt_sender.h"
+#include "rdt_receiver.h"
+#include "rdt_checksum.h"
+#include "rdt_event.h"
+#include "rdt_random.h"
+
+
+/* messages or packets a benchmark goes through before the sender or the
+   receiver is created again */
+#define ROUND 4096
+
+
+/*[]------------------------------------------------------------------------[]
+  |  allocation counting
+  []------------------------------------------------------------------------[]*/
+
+/* the rdt objects are linked with --wrap=malloc,calloc,realloc,free */
+static long alloc_cnt = 0;
+
+extern "C" {
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+void *__wrap_malloc(size_t size)
+{
+    alloc_cnt++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+    alloc_cnt++;
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    alloc_cnt++;
+    return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void *ptr)
+{
+    __real_free(ptr);
+}
+}
+
+void *operator new(size_t size)
+{
+    alloc_cnt++;
+    void *p = __real_malloc(size>0 ? size : 1);
+    if (p==NULL) throw std::bad_alloc();
+    return p;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept { __real_free(p); }
+void operator delete[](void *p) noexcept { __real_free(p); }
+void operator delete(void *p, size_t) noexcept { __real_free(p); }
+void operator delete[](void *p, size_t) noexcept { __real_free(p); }
+
+/* report the allocations since start per iteration */
+static void CountAllocs(benchmark::State &state, long start)
+{
+    state.counters["allocs/op"] = benchmark::Counter(alloc_cnt - start,
+						     benchmark::Counter::kAvgIterations);
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  stubs of the simulator
+  []------------------------------------------------------------------------[]*/
+
+/* switches of the rdt layer as name=value */
+static std::vector<std::string> bench_options;
+
+static double bench_time = 0;
+static bool sender_timer = false;
+static bool receiver_timer = false;
+static long pkts_sent = 0;
+static long msgs_delivered = 0;
+
+/* the packets passed to the lower layer are kept here while they are not
+   NULL */
+static std::vector<packet> *sender_pkts = NULL;
+static std::vector<packet> *receiver_pkts = NULL;
+
+double GetSimulationTime()
+{
+    return bench_time;
+}
+
+const char *GetSimulationOption(const char *name, const char *def)
+{
+    size_t len = strlen(name);
+    for (size_t i=0; i<bench_options.size(); i++) {
+	const char *opt = bench_options[i].c_str();
+	if (strncmp(opt, name, len)==0 && opt[len]=='=')
+	    return opt+len+1;
+    }
+    return def;
+}
+
+bool IsSimulationQuiet() { return true; }
+
+void Sender_StartTimer(double timeout) { sender_timer = true; }
+void Sender_StopTimer() { sender_timer = false; }
+bool Sender_isTimerSet() { return sender_timer; }
+void Sender_ToLowerLayer(struct packet *pkt)
+{
+    pkts_sent++;
+    if (sender_pkts!=NULL) sender_pkts->push_back(*pkt);
+}
+
+void Sender_PacketInfo(int id, bool repair) {}
+
+void Receiver_StartTimer(double timeout) { receiver_timer = true; }
+void Receiver_StopTimer() { receiver_timer = false; }
+bool Receiver_isTimerSet() { return receiver_timer; }
+void Receiver_ToLowerLayer(struct packet *pkt)
+{
+    pkts_sent++;
+    if (receiver_pkts!=NULL) receiver_pkts->push_back(*pkt);
+}
+
+void Receiver_PacketInfo(int id) {}
+void Receiver_ToUpperLayer(struct message *msg) { msgs_delivered++; }
+
+static void SetOptions(const std::vector<std::string> &options)
+{
+    bench_options = options;
+    bench_time = 0;
+    sender_timer = false;
+    receiver_timer = false;
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  recorded packets
+  []------------------------------------------------------------------------[]*/
+
+/* transfer msgs messages of size bytes from a new sender to a new receiver
+   with the switches given, and record the data packets and the acks in the
+   order they are passed.  nothing is lost, so no timer has to expire */
+static void Transfer(const std::vector<std::string> &options, int msgs, int size,
+		     std::vector<packet> *data, std::vector<packet> *acks)
+{
+    SetOptions(options);
+    std::vector<char> payload(size);
+    for (int i=0; i<size; i++)
+	payload[i] = '0' + i%10;
+    message msg;
+    msg.size = size;
+    msg.data = &payload[0];
+
+    std::vector<packet> sent, acked;
+    sender_pkts = &sent;
+    receiver_pkts = &acked;
+    Sender_Init();
+    Receiver_Init();
+    for (int i=0; i<msgs; i++)
+	Sender_FromUpperLayer(&msg);
+    while (!sent.empty()) {
+	std::vector<packet> pkts;
+	pkts.swap(sent);
+	for (size_t i=0; i<pkts.size(); i++) {
+	    data->push_back(pkts[i]);
+	    Receiver_FromLowerLayer(&pkts[i]);
+	}
+	pkts.clear();
+	pkts.swap(acked);
+	for (size_t i=0; i<pkts.size(); i++) {
+	    acks->push_back(pkts[i]);
+	    Sender_FromLowerLayer(&pkts[i]);
+	}
+    }
+    Sender_Final();
+    Receiver_Final();
+    sender_pkts = NULL;
+    receiver_pkts = NULL;
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  the rdt layer
+  []------------------------------------------------------------------------[]*/
+
+/* a message from the upper layer, of range(0) bytes, the window is never
+   acked so the messages queue up behind it */
+static void BM_SenderFromUpperLayer(benchmark::State &state)
+{
+    SetOptions({});
+    std::vector<char> data(state.range(0), 'x');
+    message msg;
+    msg.size = data.size();
+    msg.data = &data[0];
+
+    Sender_Init();
+    int n = 0;
+    long start = alloc_cnt;
+    for (auto _ : state) {
+	Sender_FromUpperLayer(&msg);
+	if (++n==ROUND) {
+	    state.PauseTiming();
+	    long paused = alloc_cnt;
+	    Sender_Final();
+	    Sender_Init();
+	    start += alloc_cnt - paused;
+	    n = 0;
+	    state.ResumeTiming();
+	}
+    }
+    CountAllocs(state, start);
+    Sender_Final();
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SenderFromUpperLayer)->Arg(20)->Arg(100)->Arg(1000);
+
+/* the acks of a transfer, each of which slides the window and sends one
+   more, range(0) is 1 for selective repeat */
+static void BM_SenderFromLowerLayer(benchmark::State &state)
+{
+    bool sr = state.range(0)!=0;
+    std::vector<std::string> options = {sr ? "arq=sr" : "arq=gbn", "window=64", "coalesce=off"};
+    std::vector<packet> data, acks;
+    Transfer(options, ROUND, 100, &data, &acks);
+    if ((int)data.size()!=ROUND || (int)acks.size()!=ROUND) {
+	state.SkipWithError("not one packet and one ack per message");
+	return;
+    }
+
+    SetOptions(options);
+    std::vector<char> payload(100, 'x');
+    message msg;
+    msg.size = payload.size();
+    msg.data = &payload[0];
+
+    /* every message is one packet, all queued before the acks come, the
+       first window is sent at once and the acks slide it over the rest */
+    long round_start;
+    auto fill = [&]() {
+	round_start = pkts_sent;
+	Sender_Init();
+	for (int i=0; i<ROUND; i++)
+	    Sender_FromUpperLayer(&msg);
+    };
+
+    fill();
+    int n = 0;
+    long start = alloc_cnt;
+    for (auto _ : state) {
+	Sender_FromLowerLayer(&acks[n]);
+	if (++n==ROUND) {
+	    state.PauseTiming();
+	    if (pkts_sent-round_start!=ROUND) {
+		state.SkipWithError("the acks did not slide the window");
+		break;
+	    }
+	    long paused = alloc_cnt;
+	    Sender_Final();
+	    fill();
+	    start += alloc_cnt - paused;
+	    n = 0;
+	    state.ResumeTiming();
+	}
+    }
+    CountAllocs(state, start);
+    Sender_Final();
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SenderFromLowerLayer)->Arg(0)->Arg(1);
+
+/* a data packet of one 100-byte message, in order if range(0) is 0, else
+   every other pair is swapped so that half the packets are buffered */
+static void BM_ReceiverFromLowerLayer(benchmark::State &state)
+{
+    std::vector<std::string> options = {"window=64", "coalesce=off"};
+    std::vector<packet> pkts, acks;
+    Transfer(options, ROUND, 100, &pkts, &acks);
+    if ((int)pkts.size()!=ROUND) {
+	state.SkipWithError("not one packet per message");
+	return;
+    }
+    if (state.range(0)!=0)
+	for (int id=0; id+1<ROUND; id+=4)
+	    std::swap(pkts[id], pkts[id+1]);
+
+    SetOptions(options);
+    Receiver_Init();
+    long round_start = msgs_delivered;
+    int n = 0;
+    long start = alloc_cnt;
+    for (auto _ : state) {
+	Receiver_FromLowerLayer(&pkts[n]);
+	if (++n==ROUND) {
+	    state.PauseTiming();
+	    if (msgs_delivered-round_start!=ROUND) {
+		state.SkipWithError("the packets were not delivered");
+		break;
+	    }
+	    long paused = alloc_cnt;
+	    Receiver_Final();
+	    Receiver_Init();
+	    round_start = msgs_delivered;
+	    start += alloc_cnt - paused;
+	    n = 0;
+	    state.ResumeTiming();
+	}
+    }
+    CountAllocs(state, start);
+    Receiver_Final();
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ReceiverFromLowerLayer)->Arg(0)->Arg(1);
+
+
+/*[]------------------------------------------------------------------------[]
+  |  checksums
+  []------------------------------------------------------------------------[]*/
+
+typedef uint32_t (*Crc32cFunc)(uint32_t crc, const void *data, size_t len);
+
+/* the checksum of a packet, as the receiver checks it */
+static void BM_Checksum(benchmark::State &state, Crc32cFunc func)
+{
+    if (func==Crc32cSse42 && !Crc32cHasSse42()) {
+	state.SkipWithError("no sse4.2");
+	return;
+    }
+    std::vector<packet> data, acks;
+    Transfer({}, 1, 100, &data, &acks);
+    packet pkt = data[0];
+
+    /* all of the packet but the 32-bit checksum itself */
+    const size_t skip = sizeof(uint32_t);
+    long start = alloc_cnt;
+    for (auto _ : state) {
+	benchmark::DoNotOptimize(pkt);
+	uint32_t checksum = func(0, pkt.data+skip, RDT_PKTSIZE-skip);
+	benchmark::DoNotOptimize(checksum);
+    }
+    CountAllocs(state, start);
+    state.SetBytesProcessed(state.iterations()*(RDT_PKTSIZE-skip));
+}
+BENCHMARK_CAPTURE(BM_Checksum, crc32c, Crc32c);
+BENCHMARK_CAPTURE(BM_Checksum, table, Crc32cTable);
+BENCHMARK_CAPTURE(BM_Checksum, sse42, Crc32cSse42);
+
+
+/*[]------------------------------------------------------------------------[]
+  |  event chain
+  []------------------------------------------------------------------------[]*/
+
+/* hold model: range(0) events are pending, each iteration takes the next one
+   and schedules it again up to 0.2s later, like a packet on the link */
+static void BM_EventChain(benchmark::State &state, const char *spec)
+{
+    EventChain chain;
+    chain.set_scheduler(CreateScheduler(spec));
+    Random rng(1);
+    std::vector<Event> events(state.range(0));
+    for (size_t i=0; i<events.size(); i++) {
+	events[i].sched_time = rng.uniform()*0.2;
+	chain.schedule(&events[i]);
+    }
+
+    long start = alloc_cnt;
+    for (auto _ : state) {
+	Event *e = chain.next_event();
+	e->sched_time = chain.time() + rng.uniform()*0.2;
+	chain.schedule(e);
+    }
+    CountAllocs(state, start);
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_CAPTURE(BM_EventChain, heap, "heap")->Arg(16)->Arg(1024)->Arg(65536);
+BENCHMARK_CAPTURE(BM_EventChain, list, "list")->Arg(16)->Arg(1024);
+BENCHMARK_CAPTURE(BM_EventChain, wheel, "wheel:0.001")->Arg(16)->Arg(1024)->Arg(65536);
+
+/* a timer pushed later before it expires, as the sender does on every ack */
+static void BM_TimerRearm(benchmark::State &state, const char *spec)
+{
+    EventChain chain;
+    chain.set_scheduler(CreateScheduler(spec));
+    TimerEvent timer;
+    double deadline = 0.3;
+    chain.arm(&timer, deadline);
+
+    long start = alloc_cnt;
+    for (auto _ : state) {
+	deadline += 0.001;
+	chain.arm(&timer, deadline);
+    }
+    CountAllocs(state, start);
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_CAPTURE(BM_TimerRearm, heap, "heap");
+BENCHMARK_CAPTURE(BM_TimerRearm, wheel, "wheel:0.001");
+
+/* the same with the clock moving: each iteration takes a packet event off
+   the chain and re-arms the timer an rto later, with range(0) packets per
+   rto.  the deadline is only stored, and the timer event comes out of the
+   chain stale at its old deadline and is put back, once per rto, which
+   the plain re-arm above never pays for */
+static void BM_TimerRearmStale(benchmark::State &state, const char *spec)
+{
+    EventChain chain;
+    chain.set_scheduler(CreateScheduler(spec));
+    TimerEvent timer;
+    Event pkt;
+    double rto = 0.3;
+    double step = rto/state.range(0);
+    pkt.sched_time = step;
+    chain.schedule(&pkt);
+    chain.arm(&timer, rto);
+
+    long start = alloc_cnt;
+    uint64_t stale = chain.stale_cnt;
+    for (auto _ : state) {
+	if (chain.next_event()!=&pkt) {
+	    state.SkipWithError("the timer expired");
+	    break;
+	}
+	pkt.sched_time = chain.time() + step;
+	chain.schedule(&pkt);
+	chain.arm(&timer, chain.time() + rto);
+    }
+    CountAllocs(state, start);
+    state.counters["stale/op"] = benchmark::Counter(chain.stale_cnt - stale,
+						    benchmark::Counter::kAvgIterations);
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_CAPTURE(BM_TimerRearmStale, heap, "heap")->Arg(1)->Arg(10)->Arg(100);
+BENCHMARK_CAPTURE(BM_TimerRearmStale, wheel, "wheel:0.001")->Arg(1)->Arg(10)->Arg(100);
+
+BENCHMARK_MAIN();
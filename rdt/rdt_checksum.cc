@@ -0,0 +1,152 @@
+/*
+ * FILE: rdt_checksum.cc
+ * DESCRIPTION: CRC32C implementations and their runtime dispatch.
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+
+#include "rdt_checksum.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define HAVE_SSE42_CRC 1
+#endif
+
+
+/*[]------------------------------------------------------------------------[]
+  |  slicing-by-8
+  []------------------------------------------------------------------------[]*/
+
+/* the reflected castagnoli polynomial */
+#define CRC32C_POLY 0x82f63b78
+
+/* crc_table[0] is the usual byte-at-a-time table, crc_table[k][b] is the crc
+   of byte b followed by k zero bytes */
+static uint32_t crc_table[8][256];
+
+static bool InitCrcTable()
+{
+    for (int b=0; b<256; b++) {
+	uint32_t crc = b;
+	for (int i=0; i<8; i++)
+	    crc = (crc>>1) ^ ((crc&1) ? CRC32C_POLY : 0);
+	crc_table[0][b] = crc;
+    }
+    for (int b=0; b<256; b++) {
+	uint32_t crc = crc_table[0][b];
+	for (int k=1; k<8; k++) {
+	    crc = (crc>>8) ^ crc_table[0][crc&0xff];
+	    crc_table[k][b] = crc;
+	}
+    }
+    return true;
+}
+
+static bool crc_table_ready = InitCrcTable();
+
+uint32_t Crc32cTable(uint32_t crc, const void *data, size_t len)
+{
+    const unsigned char *p = (const unsigned char *) data;
+    crc = ~crc;
+
+    /* 8 bytes at a time, the first 4 are folded into the crc */
+    while (len>=8) {
+	uint32_t lo, hi;
+	memcpy(&lo, p, 4);
+	memcpy(&hi, p+4, 4);
+	lo ^= crc;
+	crc = crc_table[7][lo&0xff] ^ crc_table[6][(lo>>8)&0xff] ^
+	      crc_table[5][(lo>>16)&0xff] ^ crc_table[4][lo>>24] ^
+	      crc_table[3][hi&0xff] ^ crc_table[2][(hi>>8)&0xff] ^
+	      crc_table[1][(hi>>16)&0xff] ^ crc_table[0][hi>>24];
+	p += 8;
+	len -= 8;
+    }
+    while (len>0) {
+	crc = (crc>>8) ^ crc_table[0][(crc^*p)&0xff];
+	p++;
+	len--;
+    }
+
+    return ~crc;
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  sse4.2
+  []------------------------------------------------------------------------[]*/
+
+#ifdef HAVE_SSE42_CRC
+
+__attribute__((target("sse4.2")))
+uint32_t Crc32cSse42(uint32_t crc, const void *data, size_t len)
+{
+    const unsigned char *p = (const unsigned char *) data;
+    crc = ~crc;
+
+#ifdef __x86_64__
+    uint64_t crc64 = crc;
+    while (len>=8) {
+	uint64_t v;
+	memcpy(&v, p, 8);
+	crc64 = _mm_crc32_u64(crc64, v);
+	p += 8;
+	len -= 8;
+    }
+    crc = (uint32_t) crc64;
+#endif
+    while (len>=4) {
+	uint32_t v;
+	memcpy(&v, p, 4);
+	crc = _mm_crc32_u32(crc, v);
+	p += 4;
+	len -= 4;
+    }
+    while (len>0) {
+	crc = _mm_crc32_u8(crc, *p);
+	p++;
+	len--;
+    }
+
+    return ~crc;
+}
+
+bool Crc32cHasSse42()
+{
+    return __builtin_cpu_supports("sse4.2");
+}
+
+#else
+
+uint32_t Crc32cSse42(uint32_t crc, const void *data, size_t len)
+{
+    return Crc32cTable(crc, data, len);
+}
+
+bool Crc32cHasSse42()
+{
+    return false;
+}
+
+#endif
+
+
+/*[]------------------------------------------------------------------------[]
+  |  dispatch
+  []------------------------------------------------------------------------[]*/
+
+typedef uint32_t (*Crc32cFunc)(uint32_t crc, const void *data, size_t len);
+
+static Crc32cFunc crc32c_func = Crc32cHasSse42() ? Crc32cSse42 : Crc32cTable;
+
+uint32_t Crc32c(uint32_t crc, const void *data, size_t len)
+{
+    return crc32c_func(crc, data, len);
+}
+
+const char *Crc32cBackend()
+{
+    return crc32c_func==Crc32cSse42 ? "sse4.2" : "table";
+}
@@ -0,0 +1,35 @@
+/*
+ * FILE: rdt_checksum.h
+ * DESCRIPTION: The checksum shared by the rdt sender and receiver.
+ * NOTE: The checksum is CRC32C (Castagnoli).  There are two implementations
+ *       with the same result:
+ *
+ *       table - slicing-by-8, eight 256-entry tables, 8 bytes per step
+ *       sse4.2 - the crc32 instruction, 8 bytes per instruction
+ *
+ *       Crc32c() uses the fastest one the cpu supports, which is checked once
+ *       at startup.
+ */
+
+
+#ifndef _RDT_CHECKSUM_H_
+#define _RDT_CHECKSUM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* crc32c of len bytes of data.  crc is the result for the data before it, 0
+   for the first part, so a buffer can be checksummed piece by piece. */
+uint32_t Crc32c(uint32_t crc, const void *data, size_t len);
+
+/* the implementations behind Crc32c() */
+uint32_t Crc32cTable(uint32_t crc, const void *data, size_t len);
+uint32_t Crc32cSse42(uint32_t crc, const void *data, size_t len);
+
+/* whether Crc32cSse42() can run on this cpu */
+bool Crc32cHasSse42();
+
+/* name of the implementation Crc32c() uses */
+const char *Crc32cBackend();
+
+#endif  /* _RDT_CHECKSUM_H_ */
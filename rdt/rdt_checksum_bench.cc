@@ -0,0 +1,153 @@
+/*
+ * FILE: rdt_checksum_bench.cc
+ * DESCRIPTION: Micro-benchmark of the packet checksums.
+ * NOTE: Compares the weighted byte sum the rdt layer used to have with the
+ *       CRC32C implementations in rdt_checksum.cc, both for the time per
+ *       128-byte packet and for how many corruptions they miss.  Corruptions
+ *       are made the way the simulator makes them: random bytes are changed
+ *       by a small amount.
+ *
+ *       usage: rdt_checksum_bench [<packets>] [<corruptions>]
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/time.h>
+#include <vector>
+
+#include "rdt_struct.h"
+#include "rdt_checksum.h"
+#include "rdt_random.h"
+
+
+/* the checksum field at the start of a packet is not covered */
+#define CHECKSUM_SIZE 4
+
+typedef uint32_t (*ChecksumFunc)(const char *data);
+
+/* the weighted byte sum the rdt layer used before crc32c */
+static uint32_t SumChecksum(const char *data)
+{
+    int checksum = 0;
+    for (int i=CHECKSUM_SIZE; i<RDT_PKTSIZE; i++)
+	checksum += i * data[i];
+    return checksum;
+}
+
+static uint32_t TableChecksum(const char *data)
+{
+    return Crc32cTable(0, data+CHECKSUM_SIZE, RDT_PKTSIZE-CHECKSUM_SIZE);
+}
+
+static uint32_t Sse42Checksum(const char *data)
+{
+    return Crc32cSse42(0, data+CHECKSUM_SIZE, RDT_PKTSIZE-CHECKSUM_SIZE);
+}
+
+static double WallClock()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec/1e6;
+}
+
+/* nanoseconds per packet over the packets, repeated until it takes long
+   enough to measure */
+static double TimeChecksum(ChecksumFunc func, const std::vector<packet> &pkts)
+{
+    volatile uint32_t sink = 0;
+    long rounds = 0;
+    double start = WallClock(), elapsed;
+    do {
+	uint32_t acc = 0;
+	for (size_t i=0; i<pkts.size(); i++)
+	    acc ^= func(pkts[i].data);
+	sink ^= acc;
+	rounds++;
+	elapsed = WallClock()-start;
+    } while (elapsed<0.5);
+
+    return elapsed*1e9/(rounds*(double)pkts.size());
+}
+
+/* corrupt n random bytes of the packet by -10..9 each, as the simulator does */
+static void Corrupt(packet *pkt, int n, Random &rng)
+{
+    for (int k=0; k<n; k++) {
+	int i = CHECKSUM_SIZE + (int)(rng.uniform()*(RDT_PKTSIZE-CHECKSUM_SIZE));
+	char delta;
+	do delta = (char)(rng.uniform()*20) - 10; while (delta==0);
+	pkt->data[i] += delta;
+    }
+}
+
+/* number of corruptions of n bytes the checksum does not detect */
+static long MissedCorruptions(ChecksumFunc func, int n, long trials, Random rng)
+{
+    long missed = 0;
+    packet pkt;
+    for (long t=0; t<trials; t++) {
+	for (int i=0; i<RDT_PKTSIZE; i++) pkt.data[i] = (char)rng.next();
+	uint32_t before = func(pkt.data);
+	packet orig = pkt;
+	Corrupt(&pkt, n, rng);
+	if (memcmp(orig.data, pkt.data, RDT_PKTSIZE)!=0 && func(pkt.data)==before)
+	    missed++;
+    }
+    return missed;
+}
+
+int main(int argc, char *argv[])
+{
+    long npkts = (argc>1) ? atol(argv[1]) : 4096;
+    long trials = (argc>2) ? atol(argv[2]) : 1000000;
+    if (npkts<=0 || trials<=0) {
+	fprintf(stderr, "usage: %s [<packets>] [<corruptions>]\n", argv[0]);
+	exit(-1);
+    }
+
+    /* the implementations must agree, and match the check value of crc32c */
+    const char *check = "123456789";
+    ASSERT(Crc32cTable(0, check, 9)==0xe3069283);
+    ASSERT(Crc32cSse42(0, check, 9)==0xe3069283);
+    ASSERT(Crc32c(Crc32c(0, check, 4), check+4, 5)==0xe3069283);
+
+    Random rng(1);
+    std::vector<packet> pkts(npkts);
+    for (long k=0; k<npkts; k++)
+	for (int i=0; i<RDT_PKTSIZE; i++) pkts[k].data[i] = (char)rng.next();
+    for (long k=0; k<npkts; k++)
+	ASSERT(TableChecksum(pkts[k].data)==Sse42Checksum(pkts[k].data));
+
+    struct {
+	const char *name;
+	ChecksumFunc func;
+	bool available;
+    } sums[] = {
+	{ "weighted sum", SumChecksum, true },
+	{ "crc32c table", TableChecksum, true },
+	{ "crc32c sse4.2", Sse42Checksum, Crc32cHasSse42() },
+    };
+
+    printf("## Checksums of %d-byte packets (crc32c dispatches to %s)\n",
+	   RDT_PKTSIZE, Crc32cBackend());
+    printf("\t%-16s %12s %16s %16s %16s\n", "checksum", "ns/packet",
+	   "missed 1-byte", "missed 2-byte", "missed 4-byte");
+    for (size_t s=0; s<sizeof(sums)/sizeof(sums[0]); s++) {
+	if (!sums[s].available) {
+	    printf("\t%-16s %12s\n", sums[s].name, "n/a");
+	    continue;
+	}
+	printf("\t%-16s %12.2f %16ld %16ld %16ld\n", sums[s].name,
+	       TimeChecksum(sums[s].func, pkts),
+	       MissedCorruptions(sums[s].func, 1, trials, Random(2)),
+	       MissedCorruptions(sums[s].func, 2, trials, Random(3)),
+	       MissedCorruptions(sums[s].func, 4, trials, Random(4)));
+    }
+    printf("\t(out of %ld corruptions each)\n", trials);
+
+    return 0;
+}
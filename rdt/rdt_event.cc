@@ -0,0 +1,318 @@
+/*
+ * FILE: rdt_event.cc
+ * DESCRIPTION: Scheduler backends of the simulation event chain.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+#include "rdt_event.h"
+
+
+/*[]------------------------------------------------------------------------[]
+  |  sorted linked list
+  []------------------------------------------------------------------------[]*/
+
+/* the original event chain - the events are kept on an increasing order of
+   sched_time */
+class ListScheduler : public Scheduler
+{
+public:
+    Event *head;            /* head event in the chain */
+
+public:
+    ListScheduler() { head = NULL; }
+
+    void insert(Event *e) {
+	Event **ppcur = &head;
+	while ((*ppcur!=NULL) && !EventBefore(e, *ppcur))
+	    ppcur = &((*ppcur)->next);
+
+	e->next = *ppcur;
+	*ppcur = e;
+	e->handle = 0;
+    }
+
+    void remove(Event *e) {
+	Event **ppcur = &head;
+	while ((*ppcur!=NULL) && (*ppcur!=e))
+	    ppcur = &((*ppcur)->next);
+
+	if (*ppcur==e) *ppcur=(*ppcur)->next;
+	e->handle = EVENT_UNSCHEDULED;
+    }
+
+    Event *pop() {
+	if (head==NULL) return NULL;
+
+	Event *e = head;
+	head = head->next;
+	e->handle = EVENT_UNSCHEDULED;
+
+	return e;
+    }
+};
+
+
+/*[]------------------------------------------------------------------------[]
+  |  d-ary heap
+  []------------------------------------------------------------------------[]*/
+
+/* the handle of an event is its index in the heap, so that an event can be
+   cancelled without searching for it */
+class HeapScheduler : public Scheduler
+{
+public:
+    std::vector<Event*> heap;
+    size_t arity;
+
+public:
+    HeapScheduler(int d) { arity = d; }
+
+    void insert(Event *e) {
+	heap.push_back(e);
+	sift_up(heap.size()-1);
+    }
+
+    void remove(Event *e) {
+	size_t i = e->handle;
+	Event *last = heap.back();
+	heap.pop_back();
+	e->handle = EVENT_UNSCHEDULED;
+	if (i==heap.size()) return;
+
+	place(last, i);
+	if (i>0 && EventBefore(last, heap[(i-1)/arity]))
+	    sift_up(i);
+	else
+	    sift_down(i);
+    }
+
+    Event *pop() {
+	if (heap.empty()) return NULL;
+
+	Event *e = heap[0];
+	remove(e);
+
+	return e;
+    }
+
+    void update(Event *e) {
+	sift_up(e->handle);
+    }
+
+private:
+    void place(Event *e, size_t i) {
+	heap[i] = e;
+	e->handle = (int)i;
+    }
+
+    void sift_up(size_t i) {
+	Event *e = heap[i];
+	while (i>0) {
+	    size_t parent = (i-1)/arity;
+	    if (!EventBefore(e, heap[parent])) break;
+	    place(heap[parent], i);
+	    i = parent;
+	}
+	place(e, i);
+    }
+
+    void sift_down(size_t i) {
+	Event *e = heap[i];
+	size_t n = heap.size();
+	for (;;) {
+	    size_t first = i*arity+1;
+	    if (first>=n) break;
+	    size_t last = first+arity<n ? first+arity : n;
+	    size_t best = first;
+	    for (size_t c=first+1; c<last; c++)
+		if (EventBefore(heap[c], heap[best])) best = c;
+	    if (!EventBefore(heap[best], e)) break;
+	    place(heap[best], i);
+	    i = best;
+	}
+	place(e, i);
+    }
+};
+
+
+/*[]------------------------------------------------------------------------[]
+  |  hierarchical timing wheel
+  []------------------------------------------------------------------------[]*/
+
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1<<WHEEL_BITS)
+#define WHEEL_LEVELS 10
+#define WHEEL_MAX_TICK ((((uint64_t)1)<<(WHEEL_BITS*WHEEL_LEVELS))-1)
+
+/* handle of the events in the ready list */
+#define WHEEL_READY (-2)
+
+/* the time is divided into ticks.  an event in the future is kept in the
+   level of the highest bit in which its tick differs from the current tick,
+   so all events in a level share the higher bits with the current tick and
+   the lowest occupied slot of the lowest occupied level holds the earliest
+   events.  the slots keep their events in the order they are inserted, and
+   the events of the current tick are moved to a ready list sorted by
+   sched_time and scheduling order, all of them at once when their slot
+   comes up. */
+class WheelScheduler : public Scheduler
+{
+public:
+    double tick_len;                                /* tick length (in seconds) */
+    uint64_t cur_tick;                              /* current tick */
+    Event *slots[WHEEL_LEVELS][WHEEL_SLOTS];        /* events per slot, as inserted */
+    Event *slot_tails[WHEEL_LEVELS][WHEEL_SLOTS];
+    uint64_t occupied[WHEEL_LEVELS];                /* bitmap of non-empty slots */
+    Event *ready;                                   /* events of the current tick */
+    Event *ready_tail;
+    std::vector<Event*> due;                        /* a slot coming up, to be sorted */
+
+public:
+    WheelScheduler(double tick) {
+	tick_len = tick;
+	cur_tick = 0;
+	memset(slots, 0, sizeof(slots));
+	memset(slot_tails, 0, sizeof(slot_tails));
+	memset(occupied, 0, sizeof(occupied));
+	ready = ready_tail = NULL;
+    }
+
+    void insert(Event *e) {
+	uint64_t tick = tick_of(e);
+	if (tick<=cur_tick) {
+	    ready_insert(e);
+	    return;
+	}
+
+	slot_append(e, tick);
+    }
+
+    void remove(Event *e) {
+	if (e->handle==WHEEL_READY) {
+	    if (e->prev!=NULL) e->prev->next = e->next; else ready = e->next;
+	    if (e->next!=NULL) e->next->prev = e->prev; else ready_tail = e->prev;
+	}
+	else {
+	    int level = e->handle/WHEEL_SLOTS;
+	    int slot = e->handle%WHEEL_SLOTS;
+	    if (e->prev!=NULL) e->prev->next = e->next; else slots[level][slot] = e->next;
+	    if (e->next!=NULL) e->next->prev = e->prev; else slot_tails[level][slot] = e->prev;
+	    if (slots[level][slot]==NULL) occupied[level] &= ~(((uint64_t)1)<<slot);
+	}
+	e->handle = EVENT_UNSCHEDULED;
+    }
+
+    Event *pop() {
+	while (ready==NULL) {
+	    int level = 0;
+	    while (level<WHEEL_LEVELS && occupied[level]==0) level++;
+	    if (level==WHEEL_LEVELS) return NULL;
+
+	    /* advance to the start of the earliest slot and cascade its
+	       events into the lower levels and the ready list */
+	    int slot = __builtin_ctzll(occupied[level]);
+	    int shift = (level+1)*WHEEL_BITS;
+	    uint64_t high = shift<64 ? (cur_tick>>shift)<<shift : 0;
+	    cur_tick = high | ((uint64_t)slot<<(level*WHEEL_BITS));
+
+	    Event *e = slots[level][slot];
+	    slots[level][slot] = slot_tails[level][slot] = NULL;
+	    occupied[level] &= ~(((uint64_t)1)<<slot);
+	    due.clear();
+	    while (e!=NULL) {
+		Event *next = e->next;
+		uint64_t tick = tick_of(e);
+		if (tick<=cur_tick)
+		    due.push_back(e);
+		else
+		    slot_append(e, tick);
+		e = next;
+	    }
+
+	    /* the ready list is empty, the events of the current tick form it
+	       in one pass.  the slot is mostly in order already */
+	    if (!std::is_sorted(due.begin(), due.end(), EventBefore))
+		std::sort(due.begin(), due.end(), EventBefore);
+	    for (size_t i=0; i<due.size(); i++) {
+		Event *d = due[i];
+		d->prev = ready_tail;
+		d->next = NULL;
+		if (ready_tail!=NULL) ready_tail->next = d; else ready = d;
+		ready_tail = d;
+		d->handle = WHEEL_READY;
+	    }
+	}
+
+	Event *e = ready;
+	remove(e);
+
+	return e;
+    }
+
+private:
+    uint64_t tick_of(const Event *e) {
+	double tick = e->sched_time/tick_len;
+	if (tick>=(double)WHEEL_MAX_TICK) return WHEEL_MAX_TICK;
+	return (uint64_t)tick;
+    }
+
+    /* add an event of a later tick to the tail of its slot */
+    void slot_append(Event *e, uint64_t tick) {
+	int level = (63-__builtin_clzll(tick^cur_tick))/WHEEL_BITS;
+	int slot = (tick>>(level*WHEEL_BITS)) & (WHEEL_SLOTS-1);
+	Event **tail = &slot_tails[level][slot];
+	e->prev = *tail;
+	e->next = NULL;
+	if (*tail!=NULL) (*tail)->next = e; else slots[level][slot] = e;
+	*tail = e;
+	occupied[level] |= ((uint64_t)1)<<slot;
+	e->handle = level*WHEEL_SLOTS + slot;
+    }
+
+    /* keep the ready list sorted, new events usually go to the tail */
+    void ready_insert(Event *e) {
+	Event *cur = ready_tail;
+	while (cur!=NULL && EventBefore(e, cur))
+	    cur = cur->prev;
+
+	e->prev = cur;
+	e->next = (cur!=NULL) ? cur->next : ready;
+	if (e->next!=NULL) e->next->prev = e; else ready_tail = e;
+	if (cur!=NULL) cur->next = e; else ready = e;
+	e->handle = WHEEL_READY;
+    }
+};
+
+
+/*[]------------------------------------------------------------------------[]
+  |  backend selection
+  []------------------------------------------------------------------------[]*/
+
+Scheduler *CreateScheduler(const char *spec)
+{
+    const char *arg = strchr(spec, ':');
+    size_t len = (arg!=NULL) ? (size_t)(arg-spec) : strlen(spec);
+
+    if (len==4 && strncmp(spec, "list", len)==0 && arg==NULL)
+	return new ListScheduler();
+
+    if (len==4 && strncmp(spec, "heap", len)==0) {
+	int arity = (arg!=NULL) ? atoi(arg+1) : 4;
+	if (arity<2) return NULL;
+	return new HeapScheduler(arity);
+    }
+
+    if (len==5 && strncmp(spec, "wheel", len)==0) {
+	double tick = (arg!=NULL) ? atof(arg+1) : 0.001;
+	if (tick<=0) return NULL;
+	return new WheelScheduler(tick);
+    }
+
+    return NULL;
+}
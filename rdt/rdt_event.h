@@ -0,0 +1,305 @@
+/*
+ * FILE: rdt_event.h
+ * DESCRIPTION: The generic event chain framework used by the simulator.
+ * NOTE: The event chain keeps the original schedule()/cancel()/next_event()
+ *       semantics (events are returned in increasing order of sched_time and
+ *       in FIFO order for equal sched_time), but the pending events are kept
+ *       by a pluggable scheduler backend:
+ *
+ *       list         - the original sorted singly linked list, O(n) schedule
+ *       heap[:d]     - a d-ary heap (default d=4), O(log n) schedule/cancel,
+ *                      the heap position is stored in the event as a handle
+ *       wheel[:tick] - a hierarchical timing wheel with 64 slots per level
+ *                      (default tick is 1ms), O(1) schedule/cancel, the
+ *                      events of a tick are sorted once when it comes up
+ *
+ *       Timers are events that stay scheduled for their whole life.  Moving
+ *       the deadline later or stopping the timer only changes the timer,
+ *       and the event is moved or dropped when it comes out of the chain at
+ *       the old deadline.  Moving the deadline earlier repositions the event
+ *       in the backend, O(log n) for the heap and O(1) for the wheel.
+ *
+ *       Events of equal sched_time happen in the order of the logical
+ *       process they belong to (a flow of the simulator), and in the order
+ *       they are scheduled within one, so that the events of a logical
+ *       process happen in the same order whether or not the other logical
+ *       processes share its event chain.
+ */
+
+
+#ifndef _RDT_EVENT_H_
+#define _RDT_EVENT_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+
+
+/*[]------------------------------------------------------------------------[]
+  |  generic event chain framework
+  []------------------------------------------------------------------------[]*/
+
+/* handle of an event that is not scheduled */
+#define EVENT_UNSCHEDULED (-1)
+
+/* the logical process is kept in the high bits of the scheduling order, the
+   events scheduled so far in the low bits */
+#define EVENT_LP_SHIFT 40
+
+/* simulation event base class */
+class Event
+{
+public:
+    double sched_time;      /* scheduled occuring time */
+    int event_type;         /* application-specific event type */
+    class Event *next;      /* next event in the chain */
+    class Event *prev;      /* previous event in the chain */
+    uint64_t seq;           /* scheduling order, breaks ties of sched_time */
+    int handle;             /* position in the scheduler backend */
+    bool timer;             /* a TimerEvent */
+    int lp;                 /* logical process the event belongs to */
+
+public:
+    Event() { next = NULL; prev = NULL; seq = 0; handle = EVENT_UNSCHEDULED; timer = false; lp = 0; }
+};
+
+/* timer event - sched_time and seq are where the event is in the chain,
+   deadline and deadline_seq are where it would be if it was rescheduled each
+   time the timer is armed */
+class TimerEvent : public Event
+{
+public:
+    double deadline;        /* expiration time */
+    uint64_t deadline_seq;  /* scheduling order of the last arm() */
+    bool armed;             /* the timer is set */
+
+public:
+    TimerEvent() { timer = true; deadline = 0; deadline_seq = 0; armed = false; }
+};
+
+/* the order in which the events happen */
+static inline bool EventBefore(const Event *a, const Event *b)
+{
+    if (a->sched_time!=b->sched_time) return a->sched_time<b->sched_time;
+    return a->seq<b->seq;
+}
+
+/* scheduler backend interface - keeps the pending events of an event chain.
+   a backend sets the handle of an event when it is inserted and resets it to
+   EVENT_UNSCHEDULED when it is removed or popped. */
+class Scheduler
+{
+public:
+    virtual ~Scheduler() {}
+
+    /* add a pending event */
+    virtual void insert(Event *e) = 0;
+
+    /* remove a pending event */
+    virtual void remove(Event *e) = 0;
+
+    /* remove and return the earliest pending event, NULL if there is none */
+    virtual Event *pop() = 0;
+
+    /* a pending event is moved earlier, its new sched_time and seq are set */
+    virtual void update(Event *e) { remove(e); insert(e); }
+};
+
+/* create a scheduler backend from its description, e.g. "heap:2" or
+   "wheel:0.01", return NULL if the description is invalid */
+Scheduler *CreateScheduler(const char *spec);
+
+/* event chain class - the simulation core */
+class EventChain
+{
+public:
+    double sim_time;        /* simulation time */
+    uint64_t sched_cnt;     /* number of events scheduled so far */
+    Scheduler *backend;     /* pending events */
+    uint64_t arm_cnt;       /* number of timer arms */
+    uint64_t stale_cnt;     /* number of timer expirations skipped */
+
+public:
+    EventChain() {
+	sim_time = 0;
+	sched_cnt = 0;
+	backend = CreateScheduler("heap");
+	arm_cnt = 0;
+	stale_cnt = 0;
+    }
+
+    ~EventChain() { delete backend; }
+
+    /* replace the scheduler backend, must be called before any event is
+       scheduled */
+    void set_scheduler(Scheduler *s) {
+	delete backend;
+	backend = s;
+    }
+
+    double time() { return sim_time; }
+
+    /* the scheduling order of an event of logical process lp scheduled now,
+       it can be reserved ahead of scheduling the event */
+    uint64_t order(int lp) {
+	return (((uint64_t)lp)<<EVENT_LP_SHIFT) | sched_cnt++;
+    }
+
+    /* schedule an event - events are returned in an increasing order of
+       sched_time, and in the order they are scheduled for equal sched_time */
+    void schedule(Event *e) {
+	schedule(e, order(e->lp));
+    }
+
+    /* schedule an event in an order reserved before with order() */
+    void schedule(Event *e, uint64_t seq) {
+	/* do nothing if the event is schedule for the past */
+	if (e->sched_time<sim_time) return;
+
+	e->seq = seq;
+	backend->insert(e);
+    }
+
+    /* cancel an event scheduled for happening in the future */
+    void cancel(Event *e) {
+	if (e->handle!=EVENT_UNSCHEDULED) backend->remove(e);
+    }
+
+    /* set a timer to expire at time t, in place of its previous deadline.
+       the timer expires in the same order as an event scheduled now for t */
+    void arm(TimerEvent *e, double t) {
+	if (t<sim_time) return;
+
+	e->deadline = t;
+	e->deadline_seq = order(e->lp);
+	e->armed = true;
+	arm_cnt++;
+
+	if (e->handle==EVENT_UNSCHEDULED) {
+	    e->sched_time = t;
+	    e->seq = e->deadline_seq;
+	    backend->insert(e);
+	}
+	else if (t<e->sched_time) {
+	    e->sched_time = t;
+	    e->seq = e->deadline_seq;
+	    backend->update(e);
+	}
+    }
+
+    /* stop a timer, its event is dropped when it comes out of the chain */
+    void disarm(TimerEvent *e) { e->armed = false; }
+
+    /* advance to the next event, timers that were stopped or moved later are
+       skipped without advancing the simulation time */
+    Event *next_event() { return next_event(HUGE_VAL); }
+
+    /* advance to the next event before time until, the events at or after
+       it stay in the chain */
+    Event *next_event(double until) {
+	for (;;) {
+	    Event *e = backend->pop();
+	    if (e==NULL) return NULL;
+
+	    if (e->sched_time>=until) {
+		backend->insert(e);
+		return NULL;
+	    }
+
+	    if (e->timer && !expire((TimerEvent*) e)) {
+		stale_cnt++;
+		continue;
+	    }
+
+	    sim_time = e->sched_time;
+
+	    return e;
+	}
+    }
+
+    /* the time of the earliest pending event, HUGE_VAL if there is none.  it
+       may be a stale timer, so no event happens before it but it may not
+       happen then */
+    double next_time() {
+	Event *e = backend->pop();
+	if (e==NULL) return HUGE_VAL;
+
+	backend->insert(e);
+	return e->sched_time;
+    }
+
+private:
+    /* a timer event comes out of the chain, put it back at its deadline if
+       it was moved, return whether it expires now */
+    bool expire(TimerEvent *e) {
+	if (!e->armed) return false;
+
+	if (e->sched_time!=e->deadline || e->seq!=e->deadline_seq) {
+	    e->sched_time = e->deadline;
+	    e->seq = e->deadline_seq;
+	    backend->insert(e);
+	    return false;
+	}
+
+	e->armed = false;
+	return true;
+    }
+};
+
+/* allocation statistics shared by the event pools of a simulation */
+struct EventPoolStats
+{
+    long allocated;         /* events allocated with new */
+    long recycled;          /* allocations avoided by reusing an event */
+    long live;              /* events currently handed out */
+    long peak_live;         /* maximum of live */
+};
+
+/* typed free list of events - the main loop puts an event back once it is 
+   dispatched, and the next get() reuses it instead of calling new */
+template <class T>
+class EventPool
+{
+public:
+    T *free_list;           /* recycled events, chained through next */
+    EventPoolStats *stats;
+
+public:
+    EventPool(EventPoolStats *s) {
+	free_list = NULL;
+	stats = s;
+    }
+
+    ~EventPool() {
+	while (free_list!=NULL) {
+	    T *e = free_list;
+	    free_list = (T*) e->next;
+	    delete e;
+	}
+    }
+
+    T *get() {
+	T *e = free_list;
+	if (e!=NULL) {
+	    free_list = (T*) e->next;
+	    e->next = NULL;
+	    stats->recycled++;
+	}
+	else {
+	    e = new T;
+	    stats->allocated++;
+	}
+
+	if (++stats->live>stats->peak_live) stats->peak_live = stats->live;
+
+	return e;
+    }
+
+    void put(T *e) {
+	e->next = free_list;
+	free_list = e;
+	stats->live--;
+    }
+};
+
+#endif  /* _RDT_EVENT_H_ */
@@ -0,0 +1,95 @@
+/*
+ * FILE: rdt_histogram.h
+ * DESCRIPTION: Histogram of latencies for the statistics of the simulator.
+ * NOTE: The buckets are laid out like an HdrHistogram: values below
+ *       SUB_BUCKETS are counted exactly, and every power of 2 above is split
+ *       into SUB_BUCKETS/2 buckets, so a value is known to within 1/64 of
+ *       itself whatever its magnitude.  Values are integers, the simulator
+ *       records latencies in microseconds.  Recording is an index
+ *       computation and an increment, and the buckets only grow to the
+ *       largest value recorded.
+ */
+
+
+#ifndef _RDT_HISTOGRAM_H_
+#define _RDT_HISTOGRAM_H_
+
+#include <stdint.h>
+#include <vector>
+
+class Histogram
+{
+public:
+    static const int SUB_BITS = 7;
+    static const int SUB_BUCKETS = 1<<SUB_BITS;
+
+    std::vector<uint64_t> counts;
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+    double sum;
+
+public:
+    Histogram() { total = 0; min = 0; max = 0; sum = 0; }
+
+    void record(uint64_t value) {
+	int i = index(value);
+	if (i>=(int)counts.size()) counts.resize(i+1, 0);
+	counts[i]++;
+	if (total==0 || value<min) min = value;
+	if (value>max) max = value;
+	total++;
+	sum += value;
+    }
+
+    /* add the values of another histogram */
+    void merge(const Histogram &h) {
+	if (h.total==0) return;
+	if (h.counts.size()>counts.size()) counts.resize(h.counts.size(), 0);
+	for (size_t i=0; i<h.counts.size(); i++)
+	    counts[i] += h.counts[i];
+	if (total==0 || h.min<min) min = h.min;
+	if (h.max>max) max = h.max;
+	total += h.total;
+	sum += h.sum;
+    }
+
+    double mean() const {
+	return (total>0) ? sum/total : 0;
+    }
+
+    /* the value a fraction p of the values are at or below, as the highest
+       value of its bucket, 0 if there are no values */
+    uint64_t percentile(double p) const {
+	if (total==0) return 0;
+	uint64_t rank = (uint64_t)(p*total + 0.5);
+	if (rank<1) rank = 1;
+	if (rank>total) rank = total;
+	uint64_t seen = 0;
+	for (size_t i=0; i<counts.size(); i++) {
+	    seen += counts[i];
+	    if (seen>=rank) return highest(i)<max ? highest(i) : max;
+	}
+	return max;
+    }
+
+    /* the bucket of a value */
+    static int index(uint64_t value) {
+	if (value<(uint64_t)SUB_BUCKETS) return (int)value;
+	int shift = 63 - __builtin_clzll(value) - SUB_BITS + 1;
+	return shift*(SUB_BUCKETS/2) + (int)(value>>shift);
+    }
+
+    /* the lowest and the highest value of a bucket */
+    static uint64_t lowest(int i) {
+	if (i<SUB_BUCKETS) return i;
+	int shift = i/(SUB_BUCKETS/2) - 1;
+	return (uint64_t)(i%(SUB_BUCKETS/2) + SUB_BUCKETS/2)<<shift;
+    }
+
+    static uint64_t highest(int i) {
+	return lowest(i+1) - 1;
+    }
+};
+
+#endif  /* _RDT_HISTOGRAM_H_ */
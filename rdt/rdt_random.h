@@ -0,0 +1,97 @@
+/*
+ * FILE: rdt_random.h
+ * DESCRIPTION: The pseudo random number generator of the simulator.
+ * NOTE: This is xoshiro256** (Blackman and Vigna) seeded with splitmix64.  A
+ *       generator can be split into non-overlapping streams with jump(),
+ *       which advances it by 2^128 numbers, and long_jump(), which advances
+ *       it by 2^192 numbers.  The simulator gives every run of a batch its
+ *       own long_jump() and every kind of random draw in a run its own
+ *       jump(), so runs are reproducible from the seed alone.
+ */
+
+
+#ifndef _RDT_RANDOM_H_
+#define _RDT_RANDOM_H_
+
+#include <stdint.h>
+
+class Random
+{
+public:
+    uint64_t s[4];          /* generator state */
+
+public:
+    Random() { seed(0); }
+    Random(uint64_t x) { seed(x); }
+
+    /* fill the state from a 64-bit seed with splitmix64 */
+    void seed(uint64_t x) {
+	for (int i=0; i<4; i++) {
+	    uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+	    z = (z ^ (z>>30)) * 0xbf58476d1ce4e5b9ULL;
+	    z = (z ^ (z>>27)) * 0x94d049bb133111ebULL;
+	    s[i] = z ^ (z>>31);
+	}
+    }
+
+    uint64_t next() {
+	uint64_t result = rotl(s[1]*5, 7) * 9;
+	uint64_t t = s[1]<<17;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rotl(s[3], 45);
+
+	return result;
+    }
+
+    /* a random number in [0,1) */
+    double uniform() {
+	return (next()>>11) * (1.0/9007199254740992.0);
+    }
+
+    /* advance by 2^128 numbers */
+    void jump() {
+	static const uint64_t poly[4] = {
+	    0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL,
+	    0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL };
+	advance(poly);
+    }
+
+    /* advance by 2^192 numbers */
+    void long_jump() {
+	static const uint64_t poly[4] = {
+	    0x76e15d3efefdcbbfULL, 0xc5004e441c522fb3ULL,
+	    0x77710069854ee241ULL, 0x39109bb02acbe635ULL };
+	advance(poly);
+    }
+
+private:
+    static uint64_t rotl(uint64_t x, int k) {
+	return (x<<k) | (x>>(64-k));
+    }
+
+    void advance(const uint64_t poly[4]) {
+	uint64_t t[4] = {0, 0, 0, 0};
+	for (int i=0; i<4; i++) {
+	    for (int b=0; b<64; b++) {
+		if (poly[i] & (((uint64_t)1)<<b)) {
+		    t[0] ^= s[0];
+		    t[1] ^= s[1];
+		    t[2] ^= s[2];
+		    t[3] ^= s[3];
+		}
+		next();
+	    }
+	}
+	s[0] = t[0];
+	s[1] = t[1];
+	s[2] = t[2];
+	s[3] = t[3];
+    }
+};
+
+#endif  /* _RDT_RANDOM_H_ */
@@ -5,22 +5,41 @@
  *       In this implementation, the packet format is laid out as
  *       the following:
  *
- *       |<-  4 bytes ->|<-  4 byte  ->|<-             the rest            ->|
- *       |   checksum   |    pkt_ID    |<-             payload             ->|
+ *       |<-  4 bytes ->|<- 2 bytes ->|<-             the rest            ->|
+ *       |   checksum   |    pkt_ID   |<-            segments             ->|
  *
+ *       pkt_ID is the low 16 bits of the pkt ID, see rdt_sender.cc for the
+ *       segments and the FEC repair packets.
+ *
+ *       An ack carries the highest in-order pkt_ID, the window the receiver
+ *       can buffer (in pkts), and a SACK bitmap of the pkts buffered after
+ *       pkt_ID:
+ *
+ *       |<-  4 bytes ->|<- 2 bytes ->|<- 2 bytes ->|<-  1 byte  ->|<-     sack_size bytes     ->|
+ *       |   checksum   |    pkt_ID   |    rwnd     |   sack_size  |  bit i: pkt_ID + 1 + i ok  |
  */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <memory>
+#include <vector>
 
 #include "rdt_struct.h"
+#include "rdt_checksum.h"
 #include "rdt_receiver.h"
 
-#define HEADER_SIZE 10
+#define HEADER_SIZE 6
+#define ACK_HEADER_SIZE 9
+#define SEGMENT_HEADER_SIZE 1
+#define SEGMENT_MORE 0x80
+#define FEC_HEADER_SIZE 8
+#define FEC_SIZE (RDT_PKTSIZE - FEC_HEADER_SIZE)
+#define MAX_FEC_GROUP 64
 #define WINDOW_SIZE 10
-#define MAX_WINDOW_NUM (10 * WINDOW_SIZE)
+#define MAX_WINDOW_SIZE 512
+#define DELACK_COUNT 2
 
 struct header
 {
@@ -28,128 +47,330 @@ struct header
     int checksum;
     // // checksum 2 bytes
     // short checksum;
-    int pkt_ID;
-    char has_more;
-    char payload_size;
+    unsigned short pkt_ID;
 } receiver_header;
 
-// define the window
+// fec: the pkts and repair pkts of a group received so far, and for each
+// repair pkt the XOR of it and of the pkts it covers
+struct fec_group
+{
+    int base = -1;
+    uint64_t received;
+    uint64_t repairs;
+    std::vector<char> parity;
+};
+
+// define the window, a ring buffer of the pkts after ack_num
 struct window
 {
     int ack_num = 0;
-    bool valid[WINDOW_SIZE];
-    packet *pkts[WINDOW_SIZE];
+    // the window advertised to the sender
+    int size;
+    // preallocated slots of the pkts buffered out of order
+    std::vector<bool> valid;
+    std::vector<packet> slots;
+    // the message being reassembled from the in-order payloads, its buffer
+    // only grows and is reused for every message
+    message msg;
+    int msg_capacity;
+    // delayed acks: the longest an ack waits, and the pkts one ack covers
+    double delack_interval;
+    int delack_count;
+    // pkts arrived since the last ack
+    int unacked;
+    // fec: the pkts of a group and its repair pkts (0 for no fec), the groups
+    // of the window, and the pkts rebuilt from them
+    int fec_k;
+    int fec_m;
+    std::vector<fec_group> fec_groups;
+    int recovered_cnt;
 };
 
-std::unique_ptr<window> receiver_pkt_window;
-decltype(receiver_header.checksum) receiver_CrcTable[256];
+// the receiver of the connection the simulation run by this thread works on
+static thread_local window *receiver_pkt_window;
 
 decltype(receiver_header.checksum) Receiver_Make_Checksum(packet *pkt)
 {
-    // first init to zero
-    decltype(receiver_header.checksum) checksum = 0x0;
-
-    // add all the characters in payload, but jump the checksum bits
-    for (int i = sizeof(receiver_header.checksum); i < (int)(sizeof(receiver_header.checksum) + sizeof(int)); i++)
-        checksum += i * pkt->data[i];
-
-    return checksum;
+    // crc32c of the ack, but jump the checksum bits
+    return Crc32c(0, pkt->data + sizeof(receiver_header.checksum), ACK_HEADER_SIZE + pkt->data[ACK_HEADER_SIZE - 1] - sizeof(receiver_header.checksum));
 }
 
 bool Receiver_Check_Checksum(packet *pkt)
 {
-    // first init to zero
-    decltype(receiver_header.checksum) checksum = 0x0;
-
-    // add all the characters in payload, but jump the checksum bits
-    for (int i = sizeof(receiver_header.checksum); i < RDT_PKTSIZE; i++)
-        checksum += i * pkt->data[i];
+    // crc32c of the whole packet, but jump the checksum bits
+    decltype(receiver_header.checksum) checksum = Crc32c(0, pkt->data + sizeof(receiver_header.checksum), RDT_PKTSIZE - sizeof(receiver_header.checksum));
 
-    return (decltype(receiver_header.checksum))checksum == *(decltype(receiver_header.checksum) *)(pkt->data);
+    return checksum == *(decltype(receiver_header.checksum) *)(pkt->data);
 }
 
-void Reply(int ack)
+void Reply()
 {
-    packet *pkt = new packet();
-    *(int *)(pkt->data + sizeof(receiver_header.checksum)) = ack;
+    // ack the last in-order pkt, the lower layer copies the ack
+    packet ack_pkt;
+    packet *pkt = &ack_pkt;
+    memset(pkt, 0, sizeof(packet));
+    int ack = receiver_pkt_window->ack_num - 1;
+    *(decltype(receiver_header.pkt_ID) *)(pkt->data + sizeof(receiver_header.checksum)) = ack;
+    *(unsigned short *)(pkt->data + sizeof(receiver_header.checksum) + sizeof(receiver_header.pkt_ID)) = receiver_pkt_window->size;
+
+    // sack the pkts buffered in window
+    pkt->data[ACK_HEADER_SIZE - 1] = (receiver_pkt_window->size + 7) / 8;
+    for (int i = 0; i < receiver_pkt_window->size; i++)
+    {
+        int id = ack + 1 + i;
+        if (id > receiver_pkt_window->ack_num && receiver_pkt_window->valid[id % receiver_pkt_window->size])
+            pkt->data[ACK_HEADER_SIZE + i / 8] |= 1 << (i % 8);
+    }
     *(decltype(receiver_header.checksum) *)pkt->data = Receiver_Make_Checksum(pkt);
+    Receiver_PacketInfo(ack);
     Receiver_ToLowerLayer(pkt);
+
+    // this ack covers all the pkts arrived so far
+    receiver_pkt_window->unacked = 0;
+    if (Receiver_isTimerSet())
+        Receiver_StopTimer();
 }
 
-void Wrapper_Receiver_ToUpperLayer(packet *pkt)
+void Ack(bool now)
 {
-    struct message *msg = (struct message *)malloc(sizeof(struct message));
-    ASSERT(msg != NULL);
+    // with delayed acks, an ack waits for delack_count pkts or until the
+    // timer expires, but a pkt out of order is acked at once so that the
+    // sender learns about the hole early
+    receiver_pkt_window->unacked++;
+    if (receiver_pkt_window->delack_interval <= 0 || now || receiver_pkt_window->unacked >= receiver_pkt_window->delack_count)
+    {
+        Reply();
+        return;
+    }
 
-    msg->size = pkt->data[sizeof(receiver_header.checksum) + sizeof(receiver_header.pkt_ID) + sizeof(receiver_header.has_more)];
+    if (!Receiver_isTimerSet())
+        Receiver_StartTimer(receiver_pkt_window->delack_interval);
+}
 
-    // sanity check in case the packet is corrupted
-    if (msg->size < 0)
-        msg->size = 0;
-    if (msg->size > RDT_PKTSIZE - HEADER_SIZE)
-        msg->size = RDT_PKTSIZE - HEADER_SIZE;
+int Receiver_Unwrap_ID(int base, unsigned short pkt_ID)
+{
+    // the pkt ID with these low 16 bits closest to base
+    return base + (short)(unsigned short)(pkt_ID - (unsigned short)base);
+}
 
-    msg->data = (char *)malloc(msg->size);
-    ASSERT(msg->data != NULL);
-    memcpy(msg->data, pkt->data + HEADER_SIZE, msg->size);
-    Receiver_ToUpperLayer(msg);
+void Reassemble(packet *pkt)
+{
+    // append the segments to the message, pass the message to the upper
+    // layer at each segment that ends one
+    message *msg = &receiver_pkt_window->msg;
+    int pos = HEADER_SIZE;
+    while (pos < RDT_PKTSIZE - SEGMENT_HEADER_SIZE && pkt->data[pos] != 0)
+    {
+        unsigned char segment = pkt->data[pos];
+        bool more = segment & SEGMENT_MORE;
+        int size = segment & ~SEGMENT_MORE;
+        pos += SEGMENT_HEADER_SIZE;
+
+        // sanity check in case the packet is corrupted
+        if (size > RDT_PKTSIZE - pos)
+            size = RDT_PKTSIZE - pos;
+
+        if (msg->size + size > receiver_pkt_window->msg_capacity)
+        {
+            receiver_pkt_window->msg_capacity = 2 * (msg->size + size);
+            msg->data = (char *)realloc(msg->data, receiver_pkt_window->msg_capacity);
+            ASSERT(msg->data != NULL);
+        }
+        memcpy(msg->data + msg->size, pkt->data + pos, size);
+        msg->size += size;
+        pos += size;
+
+        if (more)
+            continue;
+        Receiver_ToUpperLayer(msg);
+        msg->size = 0;
+    }
 }
 
 void Slide_Window(packet *pkt)
 {
-    int pktID = *(decltype(receiver_header.pkt_ID) *)(pkt->data + sizeof(receiver_header.checksum));
+    // the pkt is in the window, or an old one not far below it
+    int pktID = Receiver_Unwrap_ID(receiver_pkt_window->ack_num, *(decltype(receiver_header.pkt_ID) *)(pkt->data + sizeof(receiver_header.checksum)));
 
     // now window
-    if (pktID > receiver_pkt_window->ack_num && pktID < receiver_pkt_window->ack_num + WINDOW_SIZE)
+    if (pktID > receiver_pkt_window->ack_num && pktID < receiver_pkt_window->ack_num + receiver_pkt_window->size)
     {
-        if (!receiver_pkt_window->valid[pktID % WINDOW_SIZE])
+        if (!receiver_pkt_window->valid[pktID % receiver_pkt_window->size])
         {
-            receiver_pkt_window->pkts[pktID % WINDOW_SIZE] = new packet();
-            memcpy(receiver_pkt_window->pkts[pktID % WINDOW_SIZE]->data, pkt->data, RDT_PKTSIZE);
-            receiver_pkt_window->valid[pktID % WINDOW_SIZE] = true;
+            receiver_pkt_window->slots[pktID % receiver_pkt_window->size] = *pkt;
+            receiver_pkt_window->valid[pktID % receiver_pkt_window->size] = true;
         }
-        Reply(receiver_pkt_window->ack_num - 1);
+        Ack(true);
         return;
     }
 
-    // old window
+    // old window, its ack was lost, the next ack will do
     else if (pktID != receiver_pkt_window->ack_num)
     {
-        Reply(receiver_pkt_window->ack_num - 1);
+        Ack(false);
         return;
     }
 
     // new window
+    bool buffered = false;
     while (true)
     {
         receiver_pkt_window->ack_num++;
 
-        Wrapper_Receiver_ToUpperLayer(pkt);
+        Reassemble(pkt);
 
         // check duplicate
-        if (receiver_pkt_window->valid[receiver_pkt_window->ack_num % WINDOW_SIZE])
+        if (receiver_pkt_window->valid[receiver_pkt_window->ack_num % receiver_pkt_window->size])
         {
-            pkt = receiver_pkt_window->pkts[receiver_pkt_window->ack_num % WINDOW_SIZE];
-            pktID = *(int *)(pkt->data + sizeof(receiver_header.checksum));
-            receiver_pkt_window->valid[receiver_pkt_window->ack_num % WINDOW_SIZE] = false;
+            buffered = true;
+            pkt = &receiver_pkt_window->slots[receiver_pkt_window->ack_num % receiver_pkt_window->size];
+            receiver_pkt_window->valid[receiver_pkt_window->ack_num % receiver_pkt_window->size] = false;
         }
         else
         {
-            Reply(pktID);
+            // ack the pkts delivered, at once if a hole is filled
+            Ack(buffered);
             return;
         }
     };
 }
 
+fec_group *FEC_Group(int base)
+{
+    // the groups share a ring of slots, a group takes the slot of the one
+    // that many groups before it, which is complete by then
+    window *w = receiver_pkt_window;
+    fec_group *g = &w->fec_groups[base / w->fec_k % w->fec_groups.size()];
+    if (g->base == base)
+        return g;
+    // an old group
+    if (g->base > base)
+        return NULL;
+    g->base = base;
+    g->received = 0;
+    g->repairs = 0;
+    std::fill(g->parity.begin(), g->parity.end(), 0);
+    return g;
+}
+
+void FEC_Rebuild(fec_group *g, int j)
+{
+    // with a repair pkt and all but one of the pkts it covers, the XOR is the
+    // missing pkt
+    window *w = receiver_pkt_window;
+    if (!(g->repairs & (1ULL << j)))
+        return;
+    int missing = -1;
+    for (int i = j; i < w->fec_k; i += w->fec_m)
+    {
+        if (g->received & (1ULL << i))
+            continue;
+        if (missing >= 0)
+            return;
+        missing = i;
+    }
+    // the window may not have room for it yet
+    int id = g->base + missing;
+    if (missing < 0 || id < w->ack_num || id >= w->ack_num + w->size)
+        return;
+
+    packet pkt;
+    memset(&pkt, 0, sizeof(packet));
+    *(decltype(receiver_header.pkt_ID) *)(pkt.data + sizeof(receiver_header.checksum)) = id;
+    memcpy(pkt.data + HEADER_SIZE, &g->parity[j * FEC_SIZE], FEC_SIZE);
+    g->received |= 1ULL << missing;
+    w->recovered_cnt++;
+    Slide_Window(&pkt);
+}
+
+void FEC_Data(int id, packet *pkt)
+{
+    // XOR a pkt arrived for the first time into the repair pkt it belongs to
+    window *w = receiver_pkt_window;
+    if (id >= w->ack_num + w->size)
+        return;
+    fec_group *g = FEC_Group(id - id % w->fec_k);
+    int i = id % w->fec_k;
+    if (g == NULL || (g->received & (1ULL << i)))
+        return;
+    g->received |= 1ULL << i;
+
+    int j = i % w->fec_m;
+    char *parity = &g->parity[j * FEC_SIZE];
+    for (int b = 0; b < FEC_SIZE; b++)
+        parity[b] ^= pkt->data[HEADER_SIZE + b];
+    FEC_Rebuild(g, j);
+}
+
+void FEC_Repair(packet *pkt)
+{
+    window *w = receiver_pkt_window;
+    int base = Receiver_Unwrap_ID(w->ack_num, *(decltype(receiver_header.pkt_ID) *)(pkt->data + sizeof(receiver_header.checksum)));
+    int j = pkt->data[HEADER_SIZE + 1];
+    if (base < 0 || base % w->fec_k != 0 || j < 0 || j >= w->fec_m)
+        return;
+    fec_group *g = FEC_Group(base);
+    if (g == NULL || (g->repairs & (1ULL << j)))
+        return;
+    g->repairs |= 1ULL << j;
+
+    char *parity = &g->parity[j * FEC_SIZE];
+    for (int b = 0; b < FEC_SIZE; b++)
+        parity[b] ^= pkt->data[FEC_HEADER_SIZE + b];
+    FEC_Rebuild(g, j);
+}
+
 /* receiver initialization, called once at the very beginning */
 void Receiver_Init()
 {
-    fprintf(stdout, "At %.2fs: receiver initializing ...\n", GetSimulationTime());
+    if (!IsSimulationQuiet())
+        fprintf(stdout, "At %.2fs: receiver initializing ...\n", GetSimulationTime());
+
+    // init pkt buffer, its size defaults to the sender window
+    receiver_pkt_window = new window();
+    receiver_pkt_window->size = WINDOW_SIZE;
+    const char *size = GetSimulationOption("rwnd", GetSimulationOption("window", NULL));
+    if (size != NULL)
+        receiver_pkt_window->size = atoi(size);
+    if (receiver_pkt_window->size < 1 || receiver_pkt_window->size > MAX_WINDOW_SIZE)
+    {
+        fprintf(stderr, "invalid --rwnd\n");
+        exit(-1);
+    }
+    receiver_pkt_window->valid.assign(receiver_pkt_window->size, false);
+    receiver_pkt_window->slots.resize(receiver_pkt_window->size);
+    receiver_pkt_window->msg.size = 0;
+    receiver_pkt_window->msg.data = NULL;
+    receiver_pkt_window->msg_capacity = 0;
 
-    // init pkt buffer
-    receiver_pkt_window = std::make_unique<window>();
-    for (int i = 0; i < WINDOW_SIZE; i++)
-        receiver_pkt_window->pkts[i] = NULL;
+    // delayed acks, off by default
+    receiver_pkt_window->delack_interval = atof(GetSimulationOption("delack", "0"));
+    receiver_pkt_window->delack_count = DELACK_COUNT;
+    const char *count = GetSimulationOption("delack-count", NULL);
+    if (count != NULL)
+        receiver_pkt_window->delack_count = atoi(count);
+    if (receiver_pkt_window->delack_interval < 0 || receiver_pkt_window->delack_count < 1)
+    {
+        fprintf(stderr, "invalid --delack\n");
+        exit(-1);
+    }
+
+    // forward error correction, the same groups as the sender
+    const char *fec = GetSimulationOption("fec", NULL);
+    if (fec != NULL)
+    {
+        int k = 0, m = 1;
+        if (sscanf(fec, "%d,%d", &k, &m) < 1 || k < 1 || k > MAX_FEC_GROUP || m < 1 || m > k)
+        {
+            fprintf(stderr, "invalid --fec\n");
+            exit(-1);
+        }
+        receiver_pkt_window->fec_k = k;
+        receiver_pkt_window->fec_m = m;
+        receiver_pkt_window->fec_groups.resize(receiver_pkt_window->size / k + 2);
+        for (auto &g : receiver_pkt_window->fec_groups)
+            g.parity.assign(m * FEC_SIZE, 0);
+    }
 }
 
 /* receiver finalization, called once at the very end.
@@ -158,7 +379,16 @@ void Receiver_Init()
    memory you allocated in Receiver_init(). */
 void Receiver_Final()
 {
-    fprintf(stdout, "At %.2fs: receiver finalizing ...\n", GetSimulationTime());
+    if (!IsSimulationQuiet())
+    {
+        fprintf(stdout, "At %.2fs: receiver finalizing ...\n", GetSimulationTime());
+        if (receiver_pkt_window->fec_k > 0)
+            fprintf(stdout, "\t%d pkts rebuilt from repair pkts\n", receiver_pkt_window->recovered_cnt);
+    }
+
+    free(receiver_pkt_window->msg.data);
+    delete receiver_pkt_window;
+    receiver_pkt_window = NULL;
 }
 
 /* event handler, called when a packet is passed from the lower layer at the
@@ -169,5 +399,35 @@ void Receiver_FromLowerLayer(struct packet *pkt)
     if (!Receiver_Check_Checksum(pkt))
         return;
 
+    // a repair pkt has no segments
+    if (pkt->data[HEADER_SIZE] == 0)
+    {
+        if (receiver_pkt_window->fec_k > 0)
+            FEC_Repair(pkt);
+        return;
+    }
+
+    int pktID = Receiver_Unwrap_ID(receiver_pkt_window->ack_num, *(decltype(receiver_header.pkt_ID) *)(pkt->data + sizeof(receiver_header.checksum)));
+    bool in_window = pktID < receiver_pkt_window->ack_num + receiver_pkt_window->size;
     Slide_Window(pkt);
+    if (receiver_pkt_window->fec_k > 0 && in_window && pktID >= 0)
+        FEC_Data(pktID, pkt);
+}
+
+/* event handler, called when the timer expires */
+void Receiver_Timeout()
+{
+    // the delayed ack is due
+    Reply();
+}
+
+/* the context of the current connection */
+void *Receiver_GetContext()
+{
+    return receiver_pkt_window;
+}
+
+void Receiver_SetContext(void *context)
+{
+    receiver_pkt_window = (window *)context;
 }
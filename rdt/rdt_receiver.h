@@ -18,12 +18,37 @@
 /* get simulation time (in seconds) */
 double GetSimulationTime();
 
+/* look up a command line switch --name=value given to the simulator, return
+   def if the switch is not given */
+const char *GetSimulationOption(const char *name, const char *def);
+
+/* check whether the simulation runs quietly (in a batch), in which case the
+   rdt layer should not print anything either */
+bool IsSimulationQuiet();
+
 /* pass a packet to the lower layer at the receiver */
 void Receiver_ToLowerLayer(struct packet *pkt);
 
+/* tell the lower layer the pkt_ID the ack passed next acknowledges, for its
+   traces */
+void Receiver_PacketInfo(int id);
+
 /* deliver a message to the upper layer at the receiver */
 void Receiver_ToUpperLayer(struct message *msg);
 
+/* start the receiver timer with a specified timeout (in seconds).
+   the timer is cancelled with Receiver_StopTimer() is called or a new 
+   Receiver_StartTimer() is called before the current timer expires.
+   Receiver_Timeout() will be called when the timer expires. */
+void Receiver_StartTimer(double timeout);
+
+/* stop the receiver timer */
+void Receiver_StopTimer();
+
+/* check whether the receiver timer is being set,
+   return true if the timer is set, return false otherwise */
+bool Receiver_isTimerSet();
+
 
 /*[]------------------------------------------------------------------------[]
   |  routines to be changed/enhanced by you
@@ -43,4 +68,11 @@ void Receiver_Final();
    receiver */
 void Receiver_FromLowerLayer(struct packet *pkt);
 
+/* event handler, called when the timer expires */
+void Receiver_Timeout();
+
+/* the connection the calls above work on, in the same way as the sender */
+void *Receiver_GetContext();
+void Receiver_SetContext(void *context);
+
 #endif  /* _RDT_RECEIVER_H_ */
@@ -6,25 +6,69 @@
  *       situations.  In this implementation, the packet format is laid out as
  *       the following:
  *
- *       |<-  4 bytes ->|<-  4 byte  ->|<-  1 byte  ->|<-  1 byte  ->|<-             the rest            ->|
- *       |   checksum   |    pkt_ID    |    has_more  | payload_size |<-             payload             ->|
+ *       |<-  4 bytes ->|<- 2 bytes ->|<-  1 byte  ->|<- size bytes ->|<-  1 byte  ->|<- ...
+ *       |   checksum   |    pkt_ID   | more | size  |    segment     | more | size  |
  *
- *       The first byte of each packet indicates the size of the payload
- *       (excluding this single-byte header)
+ *       pkt_ID is the low 16 bits of the pkt ID, the receiver and the sender
+ *       take the ID closest to their window.  The payload is a list of
+ *       segments of messages, each after a byte of has_more (the top bit)
+ *       and its size (the other 7 bits), up to a zero byte or the end of the
+ *       packet.  A segment with has_more cleared is the end of a message, so
+ *       a packet can carry the end of one message and several small ones
+ *       after it.
+ *
+ *       With FEC, m repair packets follow every k data packets (a group,
+ *       starting at a multiple of k).  Repair packet j is the XOR of the
+ *       data packets i of the group with i % m == j, so the receiver can
+ *       rebuild one lost packet of each of them:
+ *
+ *       |<-  4 bytes ->|<- 2 bytes ->|<-  1 byte  ->|<-  1 byte  ->|<-     FEC_SIZE bytes      ->|
+ *       |   checksum   | group pkt_ID|       0      |       j      |  XOR of bytes 6.. of data  |
+ *
+ *       The zero byte is where a data packet has its first segment header,
+ *       which is never zero.  The data packets leave the last 2 bytes free
+ *       so that they are covered by the XOR.
+ *
+ *       An ack carries the highest in-order pkt_ID, the window the receiver
+ *       can buffer (in pkts), and a SACK bitmap of the pkts the receiver
+ *       buffered after pkt_ID:
+ *
+ *       |<-  4 bytes ->|<- 2 bytes ->|<- 2 bytes ->|<-  1 byte  ->|<-     sack_size bytes     ->|
+ *       |   checksum   |    pkt_ID   |    rwnd     |   sack_size  |  bit i: pkt_ID + 1 + i ok  |
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <list>
+#include <math.h>
 #include <memory>
+#include <vector>
 
 #include "rdt_struct.h"
+#include "rdt_checksum.h"
 #include "rdt_sender.h"
 
-#define HEADER_SIZE 10
+#define HEADER_SIZE 6
+#define ACK_HEADER_SIZE 9
+#define SEGMENT_HEADER_SIZE 1
+#define SEGMENT_MORE 0x80
+#define FEC_HEADER_SIZE 8
+#define FEC_SIZE (RDT_PKTSIZE - FEC_HEADER_SIZE)
+#define MAX_FEC_GROUP 64
+#define QUEUE_CHUNK 64
+#define QUEUE_SPARE 2
 #define WINDOW_SIZE 10
+#define MAX_WINDOW_SIZE 512
 #define TIME_OUT 0.3
+#define DUP_THRESH 3
+#define MIN_RTO 0.1
+#define MAX_RTO 4.0
+#define RTO_GRANULARITY 0.05
+#define REORDER_RTO 2.0
+#define SPURIOUS_RTO 3.0
+#define SPURIOUS_GAIN 0.1
+#define CUBIC_C 0.4
+#define CUBIC_BETA 0.7
 // #define TIME_OUT 0.1
 
 struct header
@@ -33,9 +77,7 @@ struct header
     int checksum;
     // // checksum 2 bytes
     // short checksum;
-    int pkt_ID;
-    char has_more;
-    char payload_size;
+    unsigned short pkt_ID;
 } sender_header;
 
 struct window
@@ -48,125 +90,799 @@ struct window
     int pkt_send_ID = 0;
     // min pkt ID acked 
     int ack_pkt_ID = 0;
-    // pkts
-    packet *pkts[WINDOW_SIZE];
+    // max pkts in window, the size of the ring buffers below
+    int size;
+    // selective repeat: when each pkt is resent, and whether it is sacked
+    std::vector<double> deadline;
+    std::vector<bool> acked;
+    // when each pkt is first sent, and whether it is resent since (karn)
+    std::vector<double> sent_time;
+    std::vector<bool> resent;
+};
+
+// the send queue, the pkts from the first chunk not acked yet on: those in
+// window, then those not in window yet.  the pkts are kept in chunks of
+// QUEUE_CHUNK slots, so that they never move, and the chunks in use form a
+// ring that only grows to hold the pkts outstanding.  the chunks of acked
+// pkts are kept as spares for the next pkts
+struct send_queue
+{
+    // the ring of chunks, count of them from first are in use
+    std::vector<packet *> chunks;
+    int first;
+    int count;
+    // the chunk number (pkt ID / QUEUE_CHUNK) of the first chunk
+    int first_chunk;
+    // one after the last pkt ID queued
+    int tail_ID;
+    // chunks not in use
+    std::vector<packet *> spare;
+};
+
+// congestion controller, keeps the congestion window (in pkts)
+struct controller
+{
+    double cwnd;
+
+    virtual ~controller() {}
+    // n pkts are newly acked
+    virtual void on_ack(int n) = 0;
+    // a pkt is lost, told by the sacks
+    virtual void on_loss() = 0;
+    // the timer expired
+    virtual void on_timeout() = 0;
+};
+
+// all the state of a sender, so that several simulations can run at once
+struct sender_context
+{
+    // pkts in window and not in window yet
+    send_queue queue;
+    // the last of them while it can take more segments, and its bytes used
+    packet *open_pkt;
+    int open_fill;
+    // small messages share pkts, and nagle holds a pkt that is not full while
+    // pkts are in flight
+    bool coalesce;
+    bool nagle;
+    // the bytes of a pkt the segments may use
+    int pkt_limit;
+    // fec: the pkts of a group and the repair pkts sent after them (0 for no
+    // fec), and the XOR of the pkts of the current group sent so far
+    int fec_k;
+    int fec_m;
+    std::vector<char> fec_parity;
+    // pkts sent again, and repair pkts sent
+    int resent_cnt;
+    int repair_cnt;
+    // pkts in window
+    window pkt_window;
+    // selective repeat instead of go back n
+    bool selective_repeat;
+    // the deadline the timer is set for
+    double timer_deadline;
+    // all pkts below it have been sent at least once
+    int max_sent_ID;
+    // the fixed rto, TIME_OUT unless --timeout is given
+    double timeout;
+    // adaptive rto instead of the fixed one
+    bool adaptive_rto;
+    // smoothed rtt, rtt variation, and the rto derived from them
+    bool rtt_valid;
+    double srtt;
+    double rttvar;
+    double rto;
+    double max_rto;
+    // --rto-tune: the rto is tuned to a link with random loss and bounded
+    // reordering, see Update_RTO()
+    bool tune;
+    // the congestion window takes a timeout as congestion, the fixed one as
+    // random loss
+    bool congestion;
+    // timeouts since the last ack, doubles the rto each
+    int backoff;
+    // the shortest rtt sampled, when the last timeout went back n, and how
+    // many of the timeouts turn out spurious (an ewma)
+    double min_rtt;
+    double timeout_time;
+    double spurious;
+    // the window the receiver advertised
+    int peer_window;
+    // congestion window, and the pkt ID a loss is recovered after
+    controller *cc;
+    int recover_ID;
+};
+
+// the sender of the connection the simulation run by this thread works on
+static thread_local sender_context *sender;
+
+double Get_RTT()
+{
+    // the smoothed rtt, the fixed rto before the first sample
+    return sender->rtt_valid ? sender->srtt : sender->timeout;
+}
+
+// loss-tolerant, the window never changes
+struct fixed_controller : controller
+{
+    fixed_controller(int size) { cwnd = size; }
+
+    void on_ack(int n) {}
+    void on_loss() {}
+    void on_timeout() {}
+};
+
+// aimd: slow start, then one more pkt per rtt, halved on loss
+struct reno_controller : controller
+{
+    double ssthresh;
+
+    reno_controller(int size)
+    {
+        cwnd = 2;
+        ssthresh = size;
+    }
+
+    void on_ack(int n)
+    {
+        for (int i = 0; i < n; i++)
+            cwnd += cwnd < ssthresh ? 1 : 1 / cwnd;
+    }
+
+    void on_loss()
+    {
+        ssthresh = cwnd / 2 > 2 ? cwnd / 2 : 2;
+        cwnd = ssthresh;
+    }
+
+    void on_timeout()
+    {
+        ssthresh = cwnd / 2 > 2 ? cwnd / 2 : 2;
+        cwnd = 1;
+    }
+};
+
+// cubic: after a loss the window grows along a cubic of the time since the
+// loss, flat around the window the loss happened at, but never slower than
+// reno would
+struct cubic_controller : controller
+{
+    double ssthresh;
+    // window at the last loss, and the time to grow back to it
+    double w_max;
+    double k;
+    // start of the current growth, negative before the first ack after a loss
+    double epoch;
+    // the window reno would have now
+    double w_reno;
+
+    cubic_controller(int size)
+    {
+        cwnd = 2;
+        ssthresh = size;
+        w_max = 0;
+        epoch = -1;
+    }
+
+    void on_ack(int n)
+    {
+        if (cwnd < ssthresh)
+        {
+            cwnd += n;
+            return;
+        }
+
+        double now = GetSimulationTime();
+        if (epoch < 0)
+        {
+            epoch = now;
+            k = w_max > cwnd ? cbrt((w_max - cwnd) / CUBIC_C) : 0;
+            if (w_max < cwnd)
+                w_max = cwnd;
+            w_reno = cwnd;
+        }
+
+        // aim at the window one rtt ahead
+        double t = now - epoch + Get_RTT();
+        double target = CUBIC_C * (t - k) * (t - k) * (t - k) + w_max;
+        w_reno += 3 * (1 - CUBIC_BETA) / (1 + CUBIC_BETA) * n / cwnd;
+        if (target < w_reno)
+            target = w_reno;
+        if (target > cwnd)
+            cwnd += (target - cwnd) / cwnd * n;
+    }
+
+    void on_loss()
+    {
+        w_max = cwnd;
+        cwnd = cwnd * CUBIC_BETA > 2 ? cwnd * CUBIC_BETA : 2;
+        ssthresh = cwnd;
+        epoch = -1;
+    }
+
+    void on_timeout()
+    {
+        w_max = cwnd;
+        ssthresh = cwnd * CUBIC_BETA > 2 ? cwnd * CUBIC_BETA : 2;
+        cwnd = 1;
+        epoch = -1;
+    }
 };
 
-std::unique_ptr<std::list<packet *>> sender_pkt_list;
-std::unique_ptr<window> sender_pkt_window;
-decltype(sender_header.checksum) sender_CrcTable[256];
+int Get_Window()
+{
+    // pkts in window are limited by the sender buffer, the window the
+    // receiver advertised, and the congestion window
+    int size = sender->pkt_window.size;
+    if (sender->peer_window < size)
+        size = sender->peer_window;
+    if ((int)sender->cc->cwnd < size)
+        size = (int)sender->cc->cwnd;
+    return size > 1 ? size : 1;
+}
+
+void Clamp_Window()
+{
+    // growing beyond the sender buffer is pointless
+    controller *cc = sender->cc;
+    if (cc->cwnd > sender->pkt_window.size)
+        cc->cwnd = sender->pkt_window.size;
+    if (cc->cwnd < 1)
+        cc->cwnd = 1;
+}
+
+void CC_Ack(int n)
+{
+    if (n <= 0)
+        return;
+    sender->cc->on_ack(n);
+    Clamp_Window();
+}
+
+void CC_Loss(bool timeout)
+{
+    // react once per window of data, the other losses of the window are
+    // part of the same congestion event
+    window &w = sender->pkt_window;
+    if (w.ack_pkt_ID < sender->recover_ID)
+        return;
+    sender->recover_ID = w.pkt_send_ID;
+
+    if (timeout)
+        sender->cc->on_timeout();
+    else
+        sender->cc->on_loss();
+    Clamp_Window();
+}
+
+packet *Queue_Slot(int id)
+{
+    // the slot of a pkt in the queue
+    send_queue &q = sender->queue;
+    int chunk = (q.first + id / QUEUE_CHUNK - q.first_chunk) % q.chunks.size();
+    return &q.chunks[chunk][id % QUEUE_CHUNK];
+}
+
+void Queue_Reserve(int n)
+{
+    // make room for n more pkts at the tail at once
+    send_queue &q = sender->queue;
+    int need = (q.tail_ID + n + QUEUE_CHUNK - 1) / QUEUE_CHUNK - q.first_chunk;
+    while (q.count < need)
+    {
+        // a full ring doubles, the chunks are laid out from the start again
+        if (q.count == (int)q.chunks.size())
+        {
+            std::vector<packet *> chunks(q.chunks.size() > 0 ? 2 * q.chunks.size() : 4, NULL);
+            for (int i = 0; i < q.count; i++)
+                chunks[i] = q.chunks[(q.first + i) % q.chunks.size()];
+            q.chunks.swap(chunks);
+            q.first = 0;
+        }
+
+        packet *chunk;
+        if (q.spare.size() > 0)
+        {
+            chunk = q.spare.back();
+            q.spare.pop_back();
+        }
+        else
+            chunk = new packet[QUEUE_CHUNK];
+        q.chunks[(q.first + q.count) % q.chunks.size()] = chunk;
+        q.count++;
+    }
+}
+
+packet *Queue_Push()
+{
+    // a new empty pkt at the tail, reserved before
+    send_queue &q = sender->queue;
+    ASSERT(q.tail_ID < (q.first_chunk + q.count) * QUEUE_CHUNK);
+    packet *pkt = Queue_Slot(q.tail_ID++);
+    memset(pkt, 0, sizeof(packet));
+    return pkt;
+}
+
+void Queue_Release(int ack_ID)
+{
+    // the chunks of pkts all acked are done with, keep a few for reuse
+    send_queue &q = sender->queue;
+    while (q.count > 0 && (q.first_chunk + 1) * QUEUE_CHUNK <= ack_ID)
+    {
+        packet *chunk = q.chunks[q.first];
+        if (q.spare.size() < QUEUE_SPARE)
+            q.spare.push_back(chunk);
+        else
+            delete[] chunk;
+        q.first = (q.first + 1) % q.chunks.size();
+        q.count--;
+        q.first_chunk++;
+    }
+}
 
 void Print_List()
 {
-    // for debug, to print the info of pkt list
-    for (auto pkt : *sender_pkt_list)
+    // for debug, to print the info of the pkts not in window
+    for (int id = sender->pkt_window.pkt_ID; id < sender->queue.tail_ID; id++)
+    {
+        packet *pkt = Queue_Slot(id);
         printf("%d %d %d\n", pkt->data[1], pkt->data[2], pkt->data[3]);
+    }
 }
 
 decltype(sender_header.checksum) Sender_Make_Checksum(packet *pkt)
 {
-    // first init to zero
-    decltype(sender_header.checksum) checksum = 0x0;
-
-    // add all the characters in payload, but jump the checksum bits
-    for (int i = sizeof(sender_header.checksum); i < RDT_PKTSIZE; i++)
-        checksum += i * pkt->data[i];
-
-    return checksum;
+    // crc32c of the whole packet, but jump the checksum bits
+    return Crc32c(0, pkt->data + sizeof(sender_header.checksum), RDT_PKTSIZE - sizeof(sender_header.checksum));
 }
 
 bool Sender_Check_Checksum(packet *pkt)
 {
-    // first init to zero
-    decltype(sender_header.checksum) checksum = 0x0;
+    // the sack size may be corrupted too
+    int sack_size = pkt->data[ACK_HEADER_SIZE - 1];
+    if (sack_size < 0 || sack_size > RDT_PKTSIZE - ACK_HEADER_SIZE)
+        return false;
 
-    // add all the characters in payload, but jump the checksum bits
-    for (int i = sizeof(sender_header.checksum); i < (int)(sizeof(sender_header.checksum) + sizeof(int)); i++)
-        checksum += i * pkt->data[i];
+    // crc32c of the ack, but jump the checksum bits
+    decltype(sender_header.checksum) checksum = Crc32c(0, pkt->data + sizeof(sender_header.checksum), ACK_HEADER_SIZE + sack_size - sizeof(sender_header.checksum));
 
-    return (decltype(sender_header.checksum))checksum == *(decltype(sender_header.checksum) *)pkt->data;
+    return checksum == *(decltype(sender_header.checksum) *)pkt->data;
+}
+
+int Sender_Unwrap_ID(int base, unsigned short pkt_ID)
+{
+    // the pkt ID with these low 16 bits closest to base
+    return base + (short)(unsigned short)(pkt_ID - (unsigned short)base);
 }
 
 void Add_Message(message *msg)
 {
-    // maximum payload size
-    int maxpayload_size = RDT_PKTSIZE - HEADER_SIZE;
+    // cut the message into segments, each goes into the open pkt if there is
+    // room, or into a new one.  the new pkts are queued at once
+    int rest = msg->size;
+    if (sender->open_pkt != NULL && sender->open_fill < sender->pkt_limit - SEGMENT_HEADER_SIZE)
+        rest -= sender->pkt_limit - sender->open_fill - SEGMENT_HEADER_SIZE;
+    if (rest > 0)
+    {
+        int room = sender->pkt_limit - HEADER_SIZE - SEGMENT_HEADER_SIZE;
+        Queue_Reserve((rest + room - 1) / room);
+    }
 
-    // split the message if it is too big
-    // the cursor always points to the first unsent byte in the message
     int index = 0;
-    while (msg->size - index * maxpayload_size > maxpayload_size)
+    while (index < msg->size)
     {
-        // fill in the packet
-        packet *pkt = new packet();
-        pkt->data[sizeof(sender_header.checksum) + sizeof(sender_header.pkt_ID)] = true;
-        pkt->data[sizeof(sender_header.checksum) + sizeof(sender_header.pkt_ID) + sizeof(sender_header.has_more)] = maxpayload_size;
-        memcpy(pkt->data + HEADER_SIZE, msg->data + index * maxpayload_size, maxpayload_size);
-
-        // add it to the list
-        sender_pkt_list->emplace_back(pkt);
+        if (sender->open_pkt == NULL || sender->open_fill >= sender->pkt_limit - SEGMENT_HEADER_SIZE)
+        {
+            sender->open_pkt = Queue_Push();
+            sender->open_fill = HEADER_SIZE;
+        }
+
+        // fill in the segment, has_more if the rest does not fit
+        packet *pkt = sender->open_pkt;
+        int size = msg->size - index;
+        int room = sender->pkt_limit - sender->open_fill - SEGMENT_HEADER_SIZE;
+        bool more = size > room;
+        if (more)
+            size = room;
+        pkt->data[sender->open_fill] = (more ? SEGMENT_MORE : 0) | size;
+        memcpy(pkt->data + sender->open_fill + SEGMENT_HEADER_SIZE, msg->data + index, size);
 
         // move the cursor
-        index++;
+        sender->open_fill += SEGMENT_HEADER_SIZE + size;
+        index += size;
+    }
+
+    // without coalescing every message starts a new pkt
+    if (!sender->coalesce)
+        sender->open_pkt = NULL;
+}
+
+double Get_RTO()
+{
+    if (!sender->adaptive_rto)
+        return sender->timeout;
+    double rto = sender->rto * (1 << sender->backoff);
+    return rto < sender->max_rto ? rto : sender->max_rto;
+}
+
+void Update_RTO(double rtt)
+{
+    // jacobson/karels estimation
+    if (!sender->rtt_valid)
+    {
+        sender->srtt = rtt;
+        sender->rttvar = rtt / 2;
+        sender->rtt_valid = true;
+    }
+    else
+    {
+        sender->rttvar = 0.75 * sender->rttvar + 0.25 * (sender->srtt > rtt ? sender->srtt - rtt : rtt - sender->srtt);
+        sender->srtt = 0.875 * sender->srtt + 0.125 * rtt;
+    }
+
+    double var = 4 * sender->rttvar;
+    double least = 0;
+    if (sender->tune)
+    {
+        // with the fixed window every loss waits for the timeout, so the rto
+        // stays close to the rtt.  a spurious timeout costs sr a pkt, but gbn
+        // the whole window, so gbn waits longer as its timeouts turn out
+        // spurious.  a congestion window collapses at a timeout, so then the
+        // rto also waits for the pkts reordering holds back, up to twice the
+        // rtt
+        if (sender->congestion)
+            least = REORDER_RTO * sender->srtt;
+        else
+        {
+            var = 2 * sender->rttvar;
+            if (!sender->selective_repeat)
+                least = (1 + SPURIOUS_RTO * sender->spurious) * sender->srtt;
+        }
     }
+    sender->rto = sender->srtt + (var > RTO_GRANULARITY ? var : RTO_GRANULARITY);
+    if (sender->rto < least)
+        sender->rto = least;
+    if (sender->rto < MIN_RTO)
+        sender->rto = MIN_RTO;
+    if (sender->rto > sender->max_rto)
+        sender->rto = sender->max_rto;
+}
+
+void Backoff_RTO()
+{
+    // exponential backoff until any ack arrives, waiting for a valid rtt
+    // sample (karn) as well would stall the sender for long under heavy
+    // loss
+    if (sender->rto * (1 << sender->backoff) < sender->max_rto)
+        sender->backoff++;
+}
+
+void Reset_Backoff()
+{
+    // the path works again, the deadlines set while backing off are pulled in
+    if (sender->backoff == 0)
+        return;
+    sender->backoff = 0;
+
+    window &w = sender->pkt_window;
+    double deadline = GetSimulationTime() + Get_RTO();
+    for (int id = w.ack_pkt_ID; id < w.pkt_send_ID; id++)
+    {
+        if (w.deadline[id % w.size] > deadline)
+            w.deadline[id % w.size] = deadline;
+    }
+}
+
+void FEC_Add(int id, packet *pkt)
+{
+    // the pkts are sent for the first time in order, XOR each into the repair
+    // pkt it belongs to, and send the repair pkts after the last pkt of the
+    // group
+    int k = sender->fec_k, m = sender->fec_m;
+    char *parity = &sender->fec_parity[(id % k % m) * FEC_SIZE];
+    for (int i = 0; i < FEC_SIZE; i++)
+        parity[i] ^= pkt->data[HEADER_SIZE + i];
+    if (id % k != k - 1)
+        return;
 
-    // prepare the last packet
-    if (msg->size > index * maxpayload_size)
+    for (int j = 0; j < m; j++)
     {
-        // fill in the packet
-        packet *pkt = new packet();
-        pkt->data[sizeof(sender_header.checksum) + sizeof(sender_header.pkt_ID)] = false;
-        pkt->data[sizeof(sender_header.checksum) + sizeof(sender_header.pkt_ID) + sizeof(sender_header.has_more)] = msg->size - index * maxpayload_size;
-        memcpy(pkt->data + HEADER_SIZE, msg->data + index * maxpayload_size, pkt->data[sizeof(sender_header.checksum) + sizeof(sender_header.pkt_ID) + sizeof(sender_header.has_more)]);
+        packet repair;
+        memset(&repair, 0, sizeof(packet));
+        *(decltype(sender_header.pkt_ID) *)(repair.data + sizeof(sender_header.checksum)) = id - k + 1;
+        repair.data[HEADER_SIZE + 1] = j;
+        memcpy(repair.data + FEC_HEADER_SIZE, &sender->fec_parity[j * FEC_SIZE], FEC_SIZE);
+        *(decltype(sender_header.checksum) *)repair.data = Sender_Make_Checksum(&repair);
+        Sender_PacketInfo(id - k + 1, true);
+        Sender_ToLowerLayer(&repair);
+        sender->repair_cnt++;
+    }
+    std::fill(sender->fec_parity.begin(), sender->fec_parity.end(), 0);
+}
 
-        // add it to the list
-        sender_pkt_list->emplace_back(pkt);
+void Transmit(int id)
+{
+    // send a pkt in window, remember when for rtt samples and deadlines
+    window &w = sender->pkt_window;
+    double now = GetSimulationTime();
+    Sender_PacketInfo(id, false);
+    Sender_ToLowerLayer(Queue_Slot(id));
+
+    if (id < sender->max_sent_ID)
+    {
+        w.resent[id % w.size] = true;
+        sender->resent_cnt++;
     }
+    else
+    {
+        w.sent_time[id % w.size] = now;
+        w.resent[id % w.size] = false;
+        sender->max_sent_ID = id + 1;
+        if (sender->fec_k > 0)
+            FEC_Add(id, Queue_Slot(id));
+    }
+    w.deadline[id % w.size] = now + Get_RTO();
 }
 
 void Send()
 {
     // send packets
-    packet *pkt;
-    while (sender_pkt_window->pkt_send_ID < sender_pkt_window->pkt_ID)
+    while (sender->pkt_window.pkt_send_ID < sender->pkt_window.pkt_ID)
+    {
+        Transmit(sender->pkt_window.pkt_send_ID);
+        sender->pkt_window.pkt_send_ID++;
+    }
+}
+
+void Sample_RTT(int ack)
+{
+    // only pkts never resent give unambiguous samples (karn), and only the
+    // first ack of a pkt tells when it arrived
+    window &w = sender->pkt_window;
+    if (!w.resent[ack % w.size] && !w.acked[ack % w.size])
+    {
+        double rtt = GetSimulationTime() - w.sent_time[ack % w.size];
+        if (sender->min_rtt == 0 || rtt < sender->min_rtt)
+            sender->min_rtt = rtt;
+        Update_RTO(rtt);
+    }
+}
+
+void Sample_Cumulative(int ack)
+{
+    // a cumulative ack that fills a hole with a resent pkt was held back by
+    // the hole, it tells nothing about the rtt of the pkts after it.  the
+    // first ack after a timeout that comes sooner than any rtt is for a pkt
+    // sent before it, so the timeout was spurious (eifel)
+    window &w = sender->pkt_window;
+    for (int id = w.ack_pkt_ID; id <= ack; id++)
+        if (w.resent[id % w.size])
+        {
+            if (sender->timeout_time > 0 && GetSimulationTime() - sender->timeout_time < sender->min_rtt)
+                sender->spurious += SPURIOUS_GAIN;
+            sender->timeout_time = 0;
+            return;
+        }
+    Sample_RTT(ack);
+}
+
+void SR_Set_Timer()
+{
+    // the single timer always expires at the earliest deadline of the pkts
+    // not acked yet
+    window &w = sender->pkt_window;
+    double earliest = -1;
+    for (int id = w.ack_pkt_ID; id < w.pkt_send_ID; id++)
+        if (!w.acked[id % w.size] && (earliest < 0 || w.deadline[id % w.size] < earliest))
+            earliest = w.deadline[id % w.size];
+
+    if (earliest < 0)
+    {
+        if (Sender_isTimerSet())
+            Sender_StopTimer();
+        return;
+    }
+
+    if (Sender_isTimerSet() && earliest == sender->timer_deadline)
+        return;
+    sender->timer_deadline = earliest;
+    Sender_StartTimer(earliest > GetSimulationTime() ? earliest - GetSimulationTime() : 0);
+}
+
+void SR_Resend()
+{
+    // resend the pkts whose deadline passed, sacked pkts are never resent
+    window &w = sender->pkt_window;
+    double now = GetSimulationTime();
+    for (int id = w.ack_pkt_ID; id < w.pkt_send_ID; id++)
     {
-        pkt = sender_pkt_window->pkts[sender_pkt_window->pkt_send_ID % WINDOW_SIZE];
-        Sender_ToLowerLayer(pkt);
-        sender_pkt_window->pkt_send_ID++;
+        if (w.acked[id % w.size] || w.deadline[id % w.size] > now + 1e-9)
+            continue;
+        Transmit(id);
     }
 }
 
+int SR_Sack(packet *pkt, int ack)
+{
+    // mark the pkts the receiver buffered, return how many are newly sacked
+    window &w = sender->pkt_window;
+    int newly_sacked = 0;
+    int sack_size = pkt->data[ACK_HEADER_SIZE - 1];
+    for (int i = 0; i < sack_size * 8; i++)
+    {
+        int id = ack + 1 + i;
+        if (id < w.ack_pkt_ID || id >= w.pkt_send_ID)
+            continue;
+        if ((pkt->data[ACK_HEADER_SIZE + i / 8] & (1 << (i % 8))) && !w.acked[id % w.size])
+        {
+            Sample_RTT(id);
+            w.acked[id % w.size] = true;
+            newly_sacked++;
+        }
+    }
+
+    // a hole with DUP_THRESH sacked pkts after it is most likely lost, resend
+    // it at once unless it was resent within the last half rto
+    double now = GetSimulationTime();
+    int sacked = 0;
+    for (int id = w.pkt_send_ID - 1; id >= w.ack_pkt_ID; id--)
+    {
+        if (w.acked[id % w.size])
+            sacked++;
+        else if (sacked >= DUP_THRESH && w.deadline[id % w.size] - now < Get_RTO() / 2)
+        {
+            CC_Loss(false);
+            Transmit(id);
+        }
+    }
+
+    return newly_sacked;
+}
+
 void Update_Window()
 {
-    while (sender_pkt_window->pkt_num < WINDOW_SIZE && sender_pkt_list->size() > 0)
+    // the pkts acked so far are not needed any more
+    Queue_Release(sender->pkt_window.ack_pkt_ID);
+
+    while (sender->pkt_window.pkt_num < Get_Window() && sender->pkt_window.pkt_ID < sender->queue.tail_ID)
     {
-        packet *pkt = sender_pkt_list->front();
-        sender_pkt_list->pop_front();
+        packet *pkt = Queue_Slot(sender->pkt_window.pkt_ID);
+
+        // nagle: a pkt that is not full waits for the pkts in flight
+        if (pkt == sender->open_pkt)
+        {
+            if (sender->nagle && sender->pkt_window.pkt_num > 0 && sender->open_fill < sender->pkt_limit - SEGMENT_HEADER_SIZE)
+                break;
+            sender->open_pkt = NULL;
+        }
 
         // set id and checksum
-        *(decltype(sender_header.pkt_ID) *)(pkt->data + sizeof(sender_header.checksum)) = sender_pkt_window->pkt_ID;
+        *(decltype(sender_header.pkt_ID) *)(pkt->data + sizeof(sender_header.checksum)) = sender->pkt_window.pkt_ID;
         *(decltype(sender_header.checksum) *)pkt->data = Sender_Make_Checksum(pkt);
 
-        // fill window with packet
-        sender_pkt_window->pkts[sender_pkt_window->pkt_ID % WINDOW_SIZE] = pkt;
-        sender_pkt_window->pkt_ID++;
-        sender_pkt_window->pkt_num++;
+        // move the pkt into window
+        sender->pkt_window.acked[sender->pkt_window.pkt_ID % sender->pkt_window.size] = false;
+        sender->pkt_window.pkt_ID++;
+        sender->pkt_window.pkt_num++;
     }
     Send();
+
+    if (sender->selective_repeat)
+        SR_Set_Timer();
 }
 
 /* sender initialization, called once at the very beginning */
 void Sender_Init()
 {
-    fprintf(stdout, "At %.2fs: sender initializing ...\n", GetSimulationTime());
+    if (!IsSimulationQuiet())
+        fprintf(stdout, "At %.2fs: sender initializing ...\n", GetSimulationTime());
+
+    // init pkt buffer and pkt window
+    sender = new sender_context();
+    window &w = sender->pkt_window;
+    w.size = WINDOW_SIZE;
+    const char *size = GetSimulationOption("window", NULL);
+    if (size != NULL)
+        w.size = atoi(size);
+    if (w.size < 1 || w.size > MAX_WINDOW_SIZE)
+    {
+        fprintf(stderr, "invalid --window\n");
+        exit(-1);
+    }
+    w.deadline.assign(w.size, 0);
+    w.acked.assign(w.size, false);
+    w.sent_time.assign(w.size, 0);
+    w.resent.assign(w.size, false);
+
+    // the receiver is assumed to have the default window until it tells
+    sender->peer_window = WINDOW_SIZE;
+
+    // congestion control
+    const char *cc = GetSimulationOption("cc", "fixed");
+    if (strcmp(cc, "fixed") == 0)
+        sender->cc = new fixed_controller(w.size);
+    else if (strcmp(cc, "reno") == 0)
+        sender->cc = new reno_controller(w.size);
+    else if (strcmp(cc, "cubic") == 0)
+        sender->cc = new cubic_controller(w.size);
+    else
+    {
+        fprintf(stderr, "invalid --cc\n");
+        exit(-1);
+    }
+    sender->congestion = strcmp(cc, "fixed") != 0;
+
+    // retransmission scheme
+    const char *arq = GetSimulationOption("arq", "gbn");
+    if (strcmp(arq, "gbn") != 0 && strcmp(arq, "sr") != 0)
+    {
+        fprintf(stderr, "invalid --arq\n");
+        exit(-1);
+    }
+    sender->selective_repeat = strcmp(arq, "sr") == 0;
+
+    // retransmission timeout
+    const char *rto = GetSimulationOption("rto", "fixed");
+    if (strcmp(rto, "fixed") != 0 && strcmp(rto, "adaptive") != 0)
+    {
+        fprintf(stderr, "invalid --rto\n");
+        exit(-1);
+    }
+    sender->adaptive_rto = strcmp(rto, "adaptive") == 0;
+    sender->timeout = TIME_OUT;
+    const char *timeout = GetSimulationOption("timeout", NULL);
+    if (timeout != NULL)
+        sender->timeout = atof(timeout);
+    if (sender->timeout <= 0)
+    {
+        fprintf(stderr, "invalid --timeout\n");
+        exit(-1);
+    }
+    sender->rto = sender->timeout;
+    const char *tune = GetSimulationOption("rto-tune", "off");
+    if (strcmp(tune, "on") != 0 && strcmp(tune, "off") != 0)
+    {
+        fprintf(stderr, "invalid --rto-tune\n");
+        exit(-1);
+    }
+    sender->tune = strcmp(tune, "on") == 0;
 
-    // init pkt buffer
-    sender_pkt_list = std::make_unique<std::list<packet *>>();
+    // message coalescing
+    const char *coalesce = GetSimulationOption("coalesce", "on");
+    if (strcmp(coalesce, "on") != 0 && strcmp(coalesce, "off") != 0 && strcmp(coalesce, "nagle") != 0)
+    {
+        fprintf(stderr, "invalid --coalesce\n");
+        exit(-1);
+    }
+    sender->coalesce = strcmp(coalesce, "off") != 0;
+    sender->nagle = strcmp(coalesce, "nagle") == 0;
+    sender->open_pkt = NULL;
+    sender->pkt_limit = RDT_PKTSIZE;
+
+    // forward error correction, off by default
+    const char *fec = GetSimulationOption("fec", NULL);
+    if (fec != NULL)
+    {
+        sender->fec_m = 1;
+        if (sscanf(fec, "%d,%d", &sender->fec_k, &sender->fec_m) < 1 || sender->fec_k < 1 || sender->fec_k > MAX_FEC_GROUP || sender->fec_m < 1 || sender->fec_m > sender->fec_k)
+        {
+            fprintf(stderr, "invalid --fec\n");
+            exit(-1);
+        }
+        sender->fec_parity.assign(sender->fec_m * FEC_SIZE, 0);
+        sender->pkt_limit = HEADER_SIZE + FEC_SIZE;
+    }
 
-    // init pkt window
-    sender_pkt_window = std::make_unique<window>();
-    for (int i = 0; i < WINDOW_SIZE; i++)
-        sender_pkt_window->pkts[i] = NULL;
+    // upper bound of the rto and its backoff
+    sender->max_rto = MAX_RTO;
+    const char *max_rto = GetSimulationOption("rto-max", NULL);
+    if (max_rto != NULL)
+        sender->max_rto = atof(max_rto);
+    if (sender->max_rto < MIN_RTO)
+    {
+        fprintf(stderr, "invalid --rto-max\n");
+        exit(-1);
+    }
 }
 
 /* sender finalization, called once at the very end.
@@ -175,7 +891,21 @@ void Sender_Init()
    memory you allocated in Sender_init(). */
 void Sender_Final()
 {
-    fprintf(stdout, "At %.2fs: sender finalizing ...\n", GetSimulationTime());
+    if (!IsSimulationQuiet())
+    {
+        fprintf(stdout, "At %.2fs: sender finalizing ...\n", GetSimulationTime());
+        if (sender->fec_k > 0)
+            fprintf(stdout, "\t%d pkts resent, %d repair pkts sent\n", sender->resent_cnt, sender->repair_cnt);
+    }
+
+    send_queue &q = sender->queue;
+    for (int i = 0; i < q.count; i++)
+        delete[] q.chunks[(q.first + i) % q.chunks.size()];
+    for (auto chunk : q.spare)
+        delete[] chunk;
+    delete sender->cc;
+    delete sender;
+    sender = NULL;
 }
 
 /* event handler, called when a message is passed from the upper layer at the
@@ -184,11 +914,18 @@ void Sender_FromUpperLayer(struct message *msg)
 {
     Add_Message(msg);
 
+    // selective repeat sends at once if the window has room
+    if (sender->selective_repeat)
+    {
+        Update_Window();
+        return;
+    }
+
     if (Sender_isTimerSet())
         return;
 
     // it is only called the first time
-    Sender_StartTimer(TIME_OUT);
+    Sender_StartTimer(Get_RTO());
     Update_Window();
 }
 
@@ -200,28 +937,85 @@ void Sender_FromLowerLayer(struct packet *pkt)
     if (!Sender_Check_Checksum(pkt))
         return;
 
-    int ack = *(int *)(pkt->data + sizeof(sender_header.checksum));
-    if (sender_pkt_window->ack_pkt_ID <= ack && ack < sender_pkt_window->pkt_ID)
+    // any ack shows the path works again
+    Reset_Backoff();
+
+    // the ack is in the window, or just below it
+    int ack = Sender_Unwrap_ID(sender->pkt_window.ack_pkt_ID, *(decltype(sender_header.pkt_ID) *)(pkt->data + sizeof(sender_header.checksum)));
+
+    // the window the receiver can buffer
+    int rwnd = *(unsigned short *)(pkt->data + sizeof(sender_header.checksum) + sizeof(sender_header.pkt_ID));
+    if (rwnd > 0)
+        sender->peer_window = rwnd;
+
+    if (sender->selective_repeat)
+    {
+        window &w = sender->pkt_window;
+        int newly_acked = 0;
+        if (sender->pkt_window.ack_pkt_ID <= ack && ack < sender->pkt_window.pkt_ID)
+        {
+            Sample_Cumulative(ack);
+            for (int id = sender->pkt_window.ack_pkt_ID; id <= ack; id++)
+                if (!w.acked[id % w.size])
+                    newly_acked++;
+            sender->pkt_window.pkt_num -= (ack - sender->pkt_window.ack_pkt_ID + 1);
+            sender->pkt_window.ack_pkt_ID = ack + 1;
+        }
+        newly_acked += SR_Sack(pkt, ack);
+        CC_Ack(newly_acked);
+        Update_Window();
+        return;
+    }
+
+    if (sender->pkt_window.ack_pkt_ID <= ack && ack < sender->pkt_window.pkt_ID)
     {
-        Sender_StartTimer(TIME_OUT);
+        Sample_Cumulative(ack);
+        CC_Ack(ack - sender->pkt_window.ack_pkt_ID + 1);
+        Sender_StartTimer(Get_RTO());
 
         // update pkt num
-        sender_pkt_window->pkt_num -= (ack - sender_pkt_window->ack_pkt_ID + 1);
+        sender->pkt_window.pkt_num -= (ack - sender->pkt_window.ack_pkt_ID + 1);
 
         // update up bound
-        sender_pkt_window->ack_pkt_ID = ack + 1;
+        sender->pkt_window.ack_pkt_ID = ack + 1;
         Update_Window();
     }
 
     // no packet now
-    if (ack == sender_pkt_window->pkt_ID - 1)
+    if (ack == sender->pkt_window.pkt_ID - 1)
         Sender_StopTimer();
 }
 
 /* event handler, called when the timer expires */
 void Sender_Timeout()
 {
-    Sender_StartTimer(TIME_OUT);
-    sender_pkt_window->pkt_send_ID = sender_pkt_window->ack_pkt_ID;
+    if (sender->adaptive_rto)
+    {
+        Backoff_RTO();
+        sender->timeout_time = GetSimulationTime();
+        sender->spurious *= 1 - SPURIOUS_GAIN;
+    }
+    CC_Loss(true);
+
+    if (sender->selective_repeat)
+    {
+        SR_Resend();
+        SR_Set_Timer();
+        return;
+    }
+
+    Sender_StartTimer(Get_RTO());
+    sender->pkt_window.pkt_send_ID = sender->pkt_window.ack_pkt_ID;
     Update_Window();
 }
+
+/* the context of the current connection */
+void *Sender_GetContext()
+{
+    return sender;
+}
+
+void Sender_SetContext(void *context)
+{
+    sender = (sender_context *)context;
+}
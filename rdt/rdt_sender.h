@@ -18,6 +18,14 @@
 /* get simulation time (in seconds) */
 double GetSimulationTime();
 
+/* look up a command line switch --name=value given to the simulator, return
+   def if the switch is not given */
+const char *GetSimulationOption(const char *name, const char *def);
+
+/* check whether the simulation runs quietly (in a batch), in which case the
+   rdt layer should not print anything either */
+bool IsSimulationQuiet();
+
 /* start the sender timer with a specified timeout (in seconds).
    the timer is canceled with Sender_StopTimer() is called or a new 
    Sender_StartTimer() is called before the current timer expires.
@@ -34,6 +42,12 @@ bool Sender_isTimerSet();
 /* pass a packet to the lower layer at the sender */
 void Sender_ToLowerLayer(struct packet *pkt);
 
+/* tell the lower layer about the packet passed next: the pkt_ID it carries,
+   and whether it is a FEC repair packet (of the group starting at that 
+   pkt_ID) rather than data.  the lower layer only uses it for statistics 
+   and traces, a packet it is not told about counts as new data */
+void Sender_PacketInfo(int id, bool repair);
+
 
 /*[]------------------------------------------------------------------------[]
   |  routines to be changed/enhanced by you
@@ -60,5 +74,12 @@ void Sender_FromLowerLayer(struct packet *pkt);
 /* event handler, called when the timer expires */
 void Sender_Timeout();
 
+/* the connection the calls above work on.  Sender_Init() creates a new one 
+   and makes it current, Sender_Final() frees the current one.  a simulation 
+   of several connections keeps the context of each after Sender_Init() and 
+   sets it again before it calls into that connection. */
+void *Sender_GetContext();
+void Sender_SetContext(void *context);
+
 
 #endif  /* _RDT_SENDER_H_ */
@@ -13,77 +13,24 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <sys/time.h>
+#include <vector>
+#include <deque>
+#include <string>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <math.h>
 
 #include "rdt_struct.h"
 #include "rdt_sender.h"
 #include "rdt_receiver.h"
-
-
-/*[]------------------------------------------------------------------------[]
-  |  generic event chain framework
-  []------------------------------------------------------------------------[]*/
-
-/* simulation event base class */
-class Event
-{
-public:
-    double sched_time;      /* scheduled occuring time */
-    int event_type;         /* application-specific event type */
-    class Event *next;      /* next event in the chain */
-
-public:
-    Event() { next = NULL; }
-};
-
-/* event chain class - the simulation core */
-class EventChain
-{
-public:
-    double sim_time;        /* simulation time */
-    Event *head;            /* head event in the chain */
-
-public:
-    EventChain() {
-	sim_time = 0;
-	head = NULL;
-    }
-    
-    double time() { return sim_time; }
-    
-    /* schedule an event - the event chain is maintained on an increasing order 
-       of sched_time */
-    void schedule(Event *e) {
-	/* do nothing if the event is schedule for the past */
-	if (e->sched_time<sim_time) return;
-
-	Event **ppcur = &head;
-	while ((*ppcur!=NULL) && ((*ppcur)->sched_time<=e->sched_time))
-	    ppcur = &((*ppcur)->next);
-
-	e->next = *ppcur;
-	*ppcur = e;
-    }
-
-    /* cancel an event scheduled for happening in the future */
-    void cancel(Event *e) {
-	Event **ppcur = &head;
-	while ((*ppcur!=NULL) && (*ppcur!=e))
-	    ppcur = &((*ppcur)->next);
-
-	if (*ppcur==e) *ppcur=(*ppcur)->next;
-    }
-
-    /* advance to the next event */
-    Event *next_event() {
-	if (head==NULL) return NULL;
-
-	Event *e = head;
-	head = head->next;
-	sim_time = e->sched_time;
-
-	return e;
-    }
-};
+#include "rdt_event.h"
+#include "rdt_random.h"
+#include "rdt_trace.h"
+#include "rdt_histogram.h"
 
 
 /*[]------------------------------------------------------------------------[]
@@ -91,12 +38,18 @@ public:
   []------------------------------------------------------------------------[]*/
 
 enum {EVENT_SENDER_FROMUPPERLAYER=0, EVENT_SENDER_FROMLOWERLAYER, 
-      EVENT_SENDER_TIMEOUT, EVENT_RECEIVER_FROMLOWERLAYER};
+      EVENT_SENDER_TIMEOUT, EVENT_RECEIVER_FROMLOWERLAYER,
+      EVENT_RECEIVER_TIMEOUT};
+
+/* every event belongs to one of the flows of a simulation */
+class Flow;
 
 /* the event that the upper layer at the sender instructs rdt layer to send out 
    a message */
 class EventSenderFromUpperLayer : public Event
 {
+public:
+    Flow *flow;
 public:
     EventSenderFromUpperLayer() { event_type = EVENT_SENDER_FROMUPPERLAYER; }
 };
@@ -106,14 +59,21 @@ public:
 class EventSenderFromLowerLayer : public Event
 {
 public:
-    struct packet pkt;
+    Flow *flow;
+    /* pkt_ID and link outcome of the packet as it was passed, for the trace */
+    int trace_id;
+    int trace_outcome;
+    /* aligned, the rdt layer reads the header fields of a packet in place */
+    alignas(int) struct packet pkt;
 public:
     EventSenderFromLowerLayer() { event_type = EVENT_SENDER_FROMLOWERLAYER; }
 };
 
 /* the event that the timer at the sender expires */
-class EventSenderTimeout : public Event
+class EventSenderTimeout : public TimerEvent
 {
+public:
+    Flow *flow;
 public:
     EventSenderTimeout() { event_type = EVENT_SENDER_TIMEOUT; }
 };
@@ -123,11 +83,25 @@ public:
 class EventReceiverFromLowerLayer : public Event
 {
 public:
-    struct packet pkt;
+    Flow *flow;
+    /* pkt_ID and link outcome of the packet as it was passed, for the trace */
+    int trace_id;
+    int trace_outcome;
+    /* aligned, the rdt layer reads the header fields of a packet in place */
+    alignas(int) struct packet pkt;
 public:
     EventReceiverFromLowerLayer() { event_type = EVENT_RECEIVER_FROMLOWERLAYER; }
 };
 
+/* the event that the timer at the receiver expires */
+class EventReceiverTimeout : public TimerEvent
+{
+public:
+    Flow *flow;
+public:
+    EventReceiverTimeout() { event_type = EVENT_RECEIVER_TIMEOUT; }
+};
+
 
 /*[]------------------------------------------------------------------------[]
   |  gloabal variables, statistics, etc.
@@ -167,29 +141,481 @@ double corrupt_rate;
 */
 int tracing_level;
 
-/* simulation event chain core */
-EventChain sim_core;
+/* independent random number streams of a simulation, so that changing how 
+   often one kind of draw happens does not perturb the others */
+enum {RAND_MSG=0, RAND_LOSS, RAND_CORRUPT, RAND_REORDER, RAND_LINK, 
+      RAND_STREAMS};
+
+/* seed of the random number generator, runs are reproducible from it */
+uint64_t rand_seed;
+
+/* event scheduler backend of the simulation core */
+const char *scheduler_spec;
+
+/* command line switches given as --name=value after the program name */
+std::vector<const char*> sim_options;
+
+/* link bandwidth (in bits per second), 0 for a link of infinite capacity 
+   where packets are never queued */
+double link_bandwidth;
+
+/* the packets a direction of the link can hold, including the one being 
+   sent, and whether the queue drops early (RED) or only when full */
+int queue_limit;
+bool red_queue;
+
+/* gilbert-elliott bursty loss: the probabilities that the channel goes from 
+   the good state to the bad one and back for each packet, and the loss rate
+   in the bad state.  the loss rate in the good state is loss_rate.  there is
+   no bursty loss if burst_enter is 0. */
+double burst_enter;
+double burst_leave;
+double burst_loss;
+
+/* number of sender/receiver pairs simulated at once, and whether their
+   packets share one link (a bottleneck) instead of each having its own */
+int num_flows;
+bool shared_link;
+
+/* threads the flows of a single simulation are partitioned over */
+int sim_threads;
+
+/* file the binary trace is written to, NULL for no trace */
+const char *trace_path;
+
+/* file the statistics are written to as JSON, NULL for none, and the length
+   of the windows the goodput over time is measured in (in seconds) */
+const char *stats_path;
+double stats_interval;
+
+/* the parameters a sweep varies.  a simulation takes them from its config 
+   instead of the globals above, which only give the defaults */
+struct SimConfig
+{
+    double msg_arrivalint;
+    int msg_size;
+    double outoforder_rate;
+    double loss_rate;
+    double corrupt_rate;
+
+    /* switches of the rdt layer as name=value, they override the command 
+       line */
+    std::vector<std::string> options;
+};
+
+
+/*[]------------------------------------------------------------------------[]
+  |  link model
+  []------------------------------------------------------------------------[]*/
+
+/* RED parameters: the queue drops early between the thresholds (fractions
+   of queue_limit) with a probability growing to RED_MAX_P, based on a moving
+   average of the queue length */
+#define RED_MIN_TH 0.25
+#define RED_MAX_TH 0.75
+#define RED_MAX_P 0.1
+#define RED_WEIGHT 0.002
+
+/* one direction of the link - a FIFO queue served at link_bandwidth, so a
+   packet leaves after the packets ahead of it and its own serialization 
+   delay, and a gilbert-elliott channel */
+class Link
+{
+public:
+    std::deque<double> departures;  /* when the queued packets leave */
+    double busy_time;               /* total time spent sending */
+    double red_avg;                 /* average queue length */
+    bool bad;                       /* state of the channel */
+    long queue_drops;
+    long burst_drops;
+
+public:
+    Link() {
+	busy_time = 0;
+	red_avg = 0;
+	bad = false;
+	queue_drops = 0;
+	burst_drops = 0;
+    }
+
+    /* queue a packet at time now, return false if the queue drops it, or 
+       the time it leaves the queue in depart */
+    bool enqueue(double now, Random &rng, double *depart) {
+	if (link_bandwidth<=0) {
+	    *depart = now;
+	    return true;
+	}
+
+	while (!departures.empty() && departures.front()<=now)
+	    departures.pop_front();
+	int qlen = departures.size();
+
+	bool drop = (qlen>=queue_limit);
+	if (red_queue && !drop) {
+	    red_avg = (1-RED_WEIGHT)*red_avg + RED_WEIGHT*qlen;
+	    double min_th = RED_MIN_TH*queue_limit, max_th = RED_MAX_TH*queue_limit;
+	    if (red_avg>=max_th)
+		drop = true;
+	    else if (red_avg>min_th)
+		drop = rng.uniform() < RED_MAX_P*(red_avg-min_th)/(max_th-min_th);
+	}
+	if (drop) {
+	    queue_drops++;
+	    return false;
+	}
+
+	double tx_time = RDT_PKTSIZE*8.0/link_bandwidth;
+	double start = departures.empty() ? now : departures.back();
+	*depart = start + tx_time;
+	departures.push_back(*depart);
+	busy_time += tx_time;
+	return true;
+    }
+
+    /* whether a packet is lost by the bursty channel */
+    bool burst_lost(Random &rng) {
+	if (burst_enter<=0) return false;
+
+	if (bad) {
+	    if (rng.uniform()<burst_leave) bad = false;
+	}
+	else {
+	    if (rng.uniform()<burst_enter) bad = true;
+	}
+	if (bad && rng.uniform()<burst_loss) {
+	    burst_drops++;
+	    return true;
+	}
+	return false;
+    }
+};
+
+/* one sender/receiver pair of a simulation, with its own messages, timers
+   and random streams, so that adding flows does not change what the flows
+   before it see */
+class Flow
+{
+public:
+    int id;
+    int partition;          /* the partition the flow is simulated in */
+
+    /* the state of the rdt layer of the connection */
+    void *sender_context;
+    void *receiver_context;
+
+    /* the recurring message arrival, and the timers re-armed in place */
+    EventSenderFromUpperLayer msg_arrival;
+    EventSenderTimeout sender_timer;
+    EventReceiverTimeout receiver_timer;
+
+    /* random number streams */
+    Random rand_streams[RAND_STREAMS];
+
+    /* the two directions of the link, its own or the shared ones */
+    Link own_data_link;
+    Link own_ack_link;
+    Link *data_link;
+    Link *ack_link;
+
+    /* next character of the generated and of the verified messages */
+    char send_cnt;
+    char verify_cnt;
+
+    /* the messages not delivered yet, as the characters sent up to the end
+       of each and the time it was generated */
+    std::deque<std::pair<int,double> > pending_msgs;
+
+    /* what the rdt layer told about the next packet it passes, the pkt_ID
+       is -1 if it told nothing */
+    int next_data_id;
+    bool next_repair;
+    int next_ack_id;
+
+    /* statistics of the flow */
+    int tot_data_sent;      /* data packets passed to the link */
+    int max_data_id;        /* highest pkt_ID of them */
+    int tot_retransmissions;/* data packets sent with a pkt_ID sent before */
+    int tot_repair_sent;    /* FEC repair packets passed to the link */
+    int tot_chars_sent;
+    int tot_chars_delivered;
+    int tot_msgs_sent;
+    int tot_msgs_delivered;
+    int tot_pkts_passed;
+    int tot_acks_passed;
+    double end_time;        /* time of the last event of the flow */
+
+    /* error flag set by message verification at the receiver */
+    bool message_verfication_passed;
+
+public:
+    Flow() {
+	partition = 0;
+	msg_arrival.flow = this;
+	sender_timer.flow = this;
+	receiver_timer.flow = this;
+	sender_context = NULL;
+	receiver_context = NULL;
+	data_link = &own_data_link;
+	ack_link = &own_ack_link;
+	send_cnt = 0;
+	verify_cnt = 0;
+	next_data_id = -1;
+	next_repair = false;
+	next_ack_id = -1;
+	tot_data_sent = 0;
+	max_data_id = -1;
+	tot_retransmissions = 0;
+	tot_repair_sent = 0;
+	tot_chars_sent = 0;
+	tot_chars_delivered = 0;
+	tot_msgs_sent = 0;
+	tot_msgs_delivered = 0;
+	tot_pkts_passed = 0;
+	tot_acks_passed = 0;
+	end_time = 0;
+	message_verfication_passed = true;
+    }
+
+    /* whether the flow is error-free, loss-free, and in order */
+    bool passed() {
+	return message_verfication_passed && (tot_chars_sent==tot_chars_delivered);
+    }
+
+    /* characters delivered per second until the flow ended */
+    double goodput() {
+	return (end_time>0) ? tot_chars_delivered/end_time : 0;
+    }
+};
+
+/* the state of one simulation run.  the parameters above are shared by all
+   runs, everything a run changes is kept here so that the runs of a batch
+   can go on in parallel, one Simulation per run. */
+class Simulation
+{
+public:
+    /* parameters of the run */
+    const SimConfig *config;
+
+    /* the flows */
+    std::vector<Flow> flows;
+
+    /* the two directions of the link shared by the flows */
+    Link data_link;
+    Link ack_link;
+
+    /* suppress all printouts of the run (batch mode) */
+    bool quiet;
+
+    /* binary trace of the run, NULL if it is not traced */
+    TraceWriter *tracer;
+
+    /* general statistics, the sums over the flows and the partitions */
+    int tot_data_sent;
+    int tot_retransmissions;
+    int tot_repair_sent;
+    int tot_chars_sent;
+    int tot_chars_delivered;
+    int tot_msgs_sent;
+    int tot_msgs_delivered;
+    int tot_pkts_passed;
+    int tot_acks_passed;
+    unsigned long long tot_events;
+    double end_time;        /* time of the last event */
+    uint64_t arm_cnt;
+    uint64_t stale_cnt;
+    EventPoolStats event_stats;         /* peak_live is the highest of the partitions */
+    std::vector<long> peak_live;        /* of each partition, at different times */
+    double wall_time;
+
+    /* threads the flows ran on, and the synchronization windows of a 
+       parallel run and their length */
+    int threads;
+    long windows;
+    double lookahead;
+
+    /* latency of the messages delivered (in microseconds), and the 
+       characters delivered in each window of stats_interval */
+    Histogram latency;
+    std::vector<long long> window_chars;
+
+    /* error flag set by message verification at any receiver */
+    bool message_verfication_passed;
+
+public:
+    /* rng is the generator of the run, split into the streams of the flows
+       here */
+    Simulation(Random rng, bool be_quiet, const SimConfig *sim_config) :
+	config(sim_config),
+	flows(num_flows) {
+	for (int f=0; f<num_flows; f++) {
+	    flows[f].id = f;
+	    flows[f].msg_arrival.lp = f;
+	    flows[f].sender_timer.lp = f;
+	    flows[f].receiver_timer.lp = f;
+	    for (int i=0; i<RAND_STREAMS; i++) {
+		flows[f].rand_streams[i] = rng;
+		rng.jump();
+	    }
+	    if (shared_link) {
+		flows[f].data_link = &data_link;
+		flows[f].ack_link = &ack_link;
+	    }
+	}
+	quiet = be_quiet;
+	tracer = NULL;
+	tot_data_sent = 0;
+	tot_retransmissions = 0;
+	tot_repair_sent = 0;
+	tot_chars_sent = 0;
+	tot_chars_delivered = 0;
+	tot_msgs_sent = 0;
+	tot_msgs_delivered = 0;
+	tot_pkts_passed = 0;
+	tot_acks_passed = 0;
+	tot_events = 0;
+	end_time = 0;
+	arm_cnt = 0;
+	stale_cnt = 0;
+	memset(&event_stats, 0, sizeof(event_stats));
+	wall_time = 0;
+	threads = 1;
+	windows = 0;
+	lookahead = 0;
+	message_verfication_passed = true;
+    }
+
+    /* whether the session is error-free, loss-free, and in order */
+    bool passed() {
+	return message_verfication_passed && (tot_chars_sent==tot_chars_delivered);
+    }
+};
+
+/* a packet passed to the shared link during a window of a parallel run.  it
+   goes over the link at the end of the window, in the order of the time it
+   was passed and the order reserved for its arrival event */
+struct LinkPacket
+{
+    double time;
+    uint64_t seq;
+    Flow *flow;
+    bool ack;               /* passed by the receiver */
+    struct packet pkt;
+};
+
+/* the flows of a simulation that one thread runs, with their own event 
+   chain.  a simulation that does not run in parallel has one partition with
+   all its flows. */
+class Partition
+{
+public:
+    Simulation *sim;
+
+    /* simulation event chain core */
+    EventChain sim_core;
+
+    /* recycled event objects */
+    EventPoolStats event_stats;
+    EventPool<EventSenderFromLowerLayer> sender_pkt_events;
+    EventPool<EventReceiverFromLowerLayer> receiver_pkt_events;
+
+    /* the flows of the partition, and the one the rdt layer is working on */
+    std::vector<Flow*> flows;
+    Flow *cur_flow;
+
+    /* the packets passed to a shared link in the current window, when the
+       link goes over them at the end of the window */
+    bool defer_link;
+    std::vector<LinkPacket> link_packets;
+
+    /* statistics of the partition, added to the simulation at the end */
+    unsigned long long tot_events;
+    Histogram latency;
+    std::vector<long long> window_chars;
+
+public:
+    Partition(Simulation *s) :
+	sender_pkt_events(&event_stats),
+	receiver_pkt_events(&event_stats) {
+	sim = s;
+	sim_core.set_scheduler(CreateScheduler(scheduler_spec));
+	memset(&event_stats, 0, sizeof(event_stats));
+	cur_flow = NULL;
+	defer_link = false;
+	tot_events = 0;
+    }
 
-/* sender timer event */
-Event *sender_timer = NULL;
+    /* make a flow the one the rdt layer works on */
+    void enter(Flow *flow) {
+	if (cur_flow==flow) return;
+	cur_flow = flow;
+	Sender_SetContext(flow->sender_context);
+	Receiver_SetContext(flow->receiver_context);
+    }
 
-/* general statistics */
-int tot_chars_sent = 0;
-int tot_chars_delivered = 0;
-int tot_pkts_passed = 0;
+    /* add a record about the current flow to the trace */
+    void trace(int type, int id, int outcome) {
+	if (sim->tracer!=NULL)
+	    sim->tracer->record(sim_core.time(), cur_flow->id, id, type, outcome);
+    }
+};
 
-/* error flag set by message verification at the receiver */
-bool message_verfication_passed = true;
+/* the partition run by the calling thread */
+static thread_local Partition *cur_part = NULL;
 
 
 /*[]------------------------------------------------------------------------[]
   |  simulation routines
   []------------------------------------------------------------------------[]*/
 
-/* generate a random number in [0,1] */
-static double myrandom()
+/* the switches the simulator reads, they hold for all the configurations
+   of a sweep */
+static const char *sim_switches[] = {
+    "scheduler", "seed", "run", "batch", "threads", "bandwidth", "queue",
+    "aqm", "burst", "flows", "link", "parallel", "trace", "stats",
+    "stats-interval", "sweep", NULL
+};
+
+/* the switches the rdt layer reads, a sweep may vary them */
+static const char *rdt_switches[] = {
+    "window", "rwnd", "cc", "arq", "rto", "timeout", "rto-max", "rto-tune",
+    "coalesce", "fec", "delack", "delack-count", NULL
+};
+
+/* check whether the first len characters of name are one of the switches */
+static bool IsSwitch(const char **switches, const char *name, size_t len)
+{
+    for (int i=0; switches[i]!=NULL; i++)
+	if (strlen(switches[i])==len && strncmp(switches[i], name, len)==0)
+	    return true;
+    return false;
+}
+
+/* look up the value of the command line switch --name=value, return def if 
+   the switch is not given */
+static const char *GetOption(const char *name, const char *def)
+{
+    size_t len = strlen(name);
+    for (size_t i=0; i<sim_options.size(); i++) {
+	const char *opt = sim_options[i]+2;
+	if (strncmp(opt, name, len)==0 && opt[len]=='=')
+	    return opt+len+1;
+    }
+    return def;
+}
+
+/* generate a random number in [0,1) from one of the streams */
+static double myrandom(int stream)
+{
+    return cur_part->cur_flow->rand_streams[stream].uniform();
+}
+
+/* the generator of a run of a batch, run 0 is the single simulation */
+static Random RunGenerator(int run)
 {
-    return(rand()*1.0/RAND_MAX);
+    Random rng(rand_seed);
+    for (int i=0; i<run; i++)
+	rng.long_jump();
+    return rng;
 }
 
 /* generate a message 
@@ -197,11 +623,13 @@ static double myrandom()
          testing.  we will certainly use different messages in our grading! */
 static struct message *generate_msg()
 {
-    static char cnt = 0;
+    Partition *part = cur_part;
+    Flow *flow = part->cur_flow;
+    char &cnt = flow->send_cnt;
 
     struct message *msg = (struct message*) malloc(sizeof(struct message));
     ASSERT(msg!=NULL);
-    msg->size = (int)(myrandom()*2.0*msg_size);
+    msg->size = (int)(myrandom(RAND_MSG)*2.0*part->sim->config->msg_size);
     if (msg->size==0) msg->size=1;
     msg->data = (char*) malloc(msg->size);
     ASSERT(msg->data!=NULL);
@@ -211,7 +639,9 @@ static struct message *generate_msg()
 	cnt = (cnt+1) % 10;
     }
 
-    tot_chars_sent += msg->size;
+    flow->tot_chars_sent += msg->size;
+    flow->tot_msgs_sent ++;
+    flow->pending_msgs.push_back(std::make_pair(flow->tot_chars_sent, part->sim_core.time()));
 
     return msg;
 }
@@ -226,7 +656,29 @@ static void free_msg(struct message *msg)
 /* get simulation time (in seconds) - for both the sender and the receiver */
 double GetSimulationTime()
 {
-    return sim_core.time();
+    return cur_part->sim_core.time();
+}
+
+/* look up a command line switch --name=value for the rdt layer, return def 
+   if the switch is not given */
+const char *GetSimulationOption(const char *name, const char *def)
+{
+    /* the switches of the configuration come first */
+    const std::vector<std::string> &options = cur_part->sim->config->options;
+    size_t len = strlen(name);
+    for (size_t i=0; i<options.size(); i++) {
+	const char *opt = options[i].c_str();
+	if (strncmp(opt, name, len)==0 && opt[len]=='=')
+	    return opt+len+1;
+    }
+    return GetOption(name, def);
+}
+
+/* check whether the simulation runs quietly (in a batch), in which case the
+   rdt layer should not print anything either */
+bool IsSimulationQuiet()
+{
+    return cur_part->sim->quiet;
 }
 
 /* start the sender timer with a specified timeout (in seconds).
@@ -235,95 +687,208 @@ double GetSimulationTime()
    Sender_Timeout() will be called when the timer expires. */
 void Sender_StartTimer(double timeout)
 {
+    Partition *part = cur_part;
+
     if (tracing_level>=1)
 	fprintf(stdout, "Time %.2fs (Sender): the timer is started (expires at %.2fs).\n",
-		sim_core.time(), sim_core.time() + timeout);
-
-    if (sender_timer!=NULL) {
-	sim_core.cancel(sender_timer);
-	delete sender_timer;
-	sender_timer = NULL;
-    }
-
-    EventSenderTimeout *e = new EventSenderTimeout;
-    e->sched_time = sim_core.time() + timeout;
-    sim_core.schedule(e);
+		part->sim_core.time(), part->sim_core.time() + timeout);
 
-    sender_timer = e;
+    part->sim_core.arm(&part->cur_flow->sender_timer, part->sim_core.time() + timeout);
 }
 
 /* stop the sender timer */
 void Sender_StopTimer()
 {
+    Partition *part = cur_part;
+
     if (tracing_level>=1)
 	fprintf(stdout, "Time %.2fs (Sender): the timer is stopped.\n", 
-		sim_core.time());
+		part->sim_core.time());
 
-    if (sender_timer!=NULL) {
-	sim_core.cancel(sender_timer);
-	delete sender_timer;
-	sender_timer = NULL;
-    }
+    part->sim_core.disarm(&part->cur_flow->sender_timer);
 }
 
 /* check whether the sender timer is being set,
    return true if the timer is set, return false otherwise */
 bool Sender_isTimerSet()
 {
-    return (sender_timer!=NULL);
+    return cur_part->cur_flow->sender_timer.armed;
 }
 
-/* pass a packet to the lower layer at the sender */
-void Sender_ToLowerLayer(struct packet *pkt)
+/* start the receiver timer with a specified timeout (in seconds), in the
+   same way as the sender timer.  Receiver_Timeout() will be called when the
+   timer expires. */
+void Receiver_StartTimer(double timeout)
 {
-    /* packet lost at rate "loss_rate" */
-    if (myrandom()<loss_rate) return;
+    Partition *part = cur_part;
 
-    EventReceiverFromLowerLayer *e = new EventReceiverFromLowerLayer;
-    memcpy(&e->pkt.data, pkt->data, RDT_PKTSIZE);
+    if (tracing_level>=1)
+	fprintf(stdout, "Time %.2fs (Receiver): the timer is started (expires at %.2fs).\n",
+		part->sim_core.time(), part->sim_core.time() + timeout);
 
-    /* packet corrupted at rate "corrupt_rate" */
-    if (myrandom()<corrupt_rate) {
-	for (int i=0; i<RDT_PKTSIZE; i++) {
-	    e->pkt.data[i] = e->pkt.data[i] + (char)(myrandom()*20) - 10;
-	}
-    }
+    part->sim_core.arm(&part->cur_flow->receiver_timer, part->sim_core.time() + timeout);
+}
 
-    /* schedule the packet arrival event at the other side */
-    if (myrandom()<outoforder_rate)
-	e->sched_time = sim_core.time() + pkt_latency*2.0*myrandom();
-    else
-	e->sched_time = sim_core.time() + pkt_latency;
-    sim_core.schedule(e);
+/* stop the receiver timer */
+void Receiver_StopTimer()
+{
+    Partition *part = cur_part;
+
+    if (tracing_level>=1)
+	fprintf(stdout, "Time %.2fs (Receiver): the timer is stopped.\n", 
+		part->sim_core.time());
 
-    tot_pkts_passed ++;
+    part->sim_core.disarm(&part->cur_flow->receiver_timer);
 }
 
+/* check whether the receiver timer is being set */
+bool Receiver_isTimerSet()
+{
+    return cur_part->cur_flow->receiver_timer.armed;
+}
 
-/* pass a packet to the lower layer at the receiver */
-void Receiver_ToLowerLayer(struct packet *pkt)
+/* pass a packet of a flow over one direction of its link at time now: the
+   packet is queued, lost, corrupted or reordered, and the event of its 
+   arrival at the other side is returned, NULL if it does not arrive.  id is
+   the pkt_ID of the packet for the trace, and repair is TRACE_REPAIR for a 
+   FEC repair packet.  the random streams of the link 
+   are only drawn from here, so this can be done later than the packet is 
+   passed by the rdt layer */
+template <class T>
+static T *PassPacket(Partition *part, Flow *flow, double now, bool ack, 
+		     EventPool<T> *pool, const struct packet *pkt, int id, int repair)
 {
+    const SimConfig *config = part->sim->config;
+    Random *rng = flow->rand_streams;
+    Link *link = ack ? flow->ack_link : flow->data_link;
+    int type = ack ? TRACE_RECEIVER_TOLOWERLAYER : TRACE_SENDER_TOLOWERLAYER;
+
+    /* packet queued for the link, it may not fit */
+    double depart;
+    if (!link->enqueue(now, rng[RAND_LINK], &depart)) {
+	part->trace(type, id, TRACE_DROPPED|repair);
+	return NULL;
+    }
+
     /* packet lost at rate "loss_rate" */
-    if (myrandom()<loss_rate) return;
+    if (rng[RAND_LOSS].uniform()<config->loss_rate || 
+	link->burst_lost(rng[RAND_LINK])) {
+	part->trace(type, id, TRACE_LOST|repair);
+	return NULL;
+    }
 
-    EventSenderFromLowerLayer *e = new EventSenderFromLowerLayer;
+    T *e = pool->get();
+    e->flow = flow;
+    e->lp = flow->id;
     memcpy(&e->pkt.data, pkt->data, RDT_PKTSIZE);
 
     /* packet corrupted at rate "corrupt_rate" */
-    if (myrandom()<corrupt_rate) {
+    int outcome = repair;
+    if (rng[RAND_CORRUPT].uniform()<config->corrupt_rate) {
 	for (int i=0; i<RDT_PKTSIZE; i++) {
-	    e->pkt.data[i] = e->pkt.data[i] + (char)(myrandom()*20) - 10;
+	    e->pkt.data[i] = e->pkt.data[i] + (char)(rng[RAND_CORRUPT].uniform()*20) - 10;
 	}
+	outcome |= TRACE_CORRUPTED;
     }
 
-    /* schedule the packet arrival event at the other side */
-    if (myrandom()<outoforder_rate)
-	e->sched_time = sim_core.time() + pkt_latency*2.0*myrandom();
+    /* the packet arrives at the other side after it leaves the link queue */
+    if (rng[RAND_REORDER].uniform()<config->outoforder_rate) {
+	e->sched_time = depart + pkt_latency*2.0*rng[RAND_REORDER].uniform();
+	outcome |= TRACE_REORDERED;
+    }
     else
-	e->sched_time = sim_core.time() + pkt_latency;	
-    sim_core.schedule(e);
+	e->sched_time = depart + pkt_latency;
+    part->trace(type, id, outcome);
+    e->trace_id = id;
+    e->trace_outcome = outcome;
+
+    flow->tot_pkts_passed ++;
+    if (ack) flow->tot_acks_passed ++;
+    return e;
+}
+
+/* keep a packet of the current flow for the shared link until the end of the
+   window, with the order its arrival event would have been scheduled in */
+static void DeferPacket(Partition *part, bool ack, const struct packet *pkt)
+{
+    part->link_packets.push_back(LinkPacket());
+    LinkPacket &p = part->link_packets.back();
+    p.time = part->sim_core.time();
+    p.seq = part->sim_core.order(part->cur_flow->id);
+    p.flow = part->cur_flow;
+    p.ack = ack;
+    memcpy(p.pkt.data, pkt->data, RDT_PKTSIZE);
+}
+
+/* the rdt layer tells the pkt_ID and kind of the packet it passes next at
+   the sender */
+void Sender_PacketInfo(int id, bool repair)
+{
+    cur_part->cur_flow->next_data_id = id;
+    cur_part->cur_flow->next_repair = repair;
+}
+
+/* pass a packet to the lower layer at the sender */
+void Sender_ToLowerLayer(struct packet *pkt)
+{
+    Partition *part = cur_part;
+    Flow *flow = part->cur_flow;
+
+    /* the packet is opaque, the rdt layer tells its pkt_ID and kind with 
+       Sender_PacketInfo().  a data packet with a pkt_ID not above the 
+       highest one sent before is a retransmission, the FEC repair packets
+       are counted on their own */
+    int id = flow->next_data_id;
+    bool repair = flow->next_repair;
+    flow->next_data_id = -1;
+    flow->next_repair = false;
+    if (repair)
+	flow->tot_repair_sent ++;
+    else {
+	flow->tot_data_sent ++;
+	if (id>=0 && id<=flow->max_data_id)
+	    flow->tot_retransmissions ++;
+	flow->max_data_id = std::max(flow->max_data_id, id);
+    }
 
-    tot_pkts_passed ++;
+    if (part->defer_link) {
+	DeferPacket(part, false, pkt);
+	return;
+    }
+
+    /* schedule the packet arrival event at the receiver */
+    EventReceiverFromLowerLayer *e = 
+	PassPacket(part, flow, part->sim_core.time(), false, &part->receiver_pkt_events, pkt, id,
+		   repair ? TRACE_REPAIR : 0);
+    if (e!=NULL)
+	part->sim_core.schedule(e);
+}
+
+
+/* the rdt layer tells the pkt_ID the ack it passes next acknowledges */
+void Receiver_PacketInfo(int id)
+{
+    cur_part->cur_flow->next_ack_id = id;
+}
+
+/* pass a packet to the lower layer at the receiver */
+void Receiver_ToLowerLayer(struct packet *pkt)
+{
+    Partition *part = cur_part;
+    Flow *flow = part->cur_flow;
+    int id = flow->next_ack_id;
+    flow->next_ack_id = -1;
+
+    if (part->defer_link) {
+	DeferPacket(part, true, pkt);
+	return;
+    }
+
+    /* schedule the packet arrival event at the sender */
+    EventSenderFromLowerLayer *e = 
+	PassPacket(part, flow, part->sim_core.time(), true, &part->sender_pkt_events, pkt, id, 0);
+    if (e!=NULL)
+	part->sim_core.schedule(e);
 }
 
 /* deliver a message to the upper layer at the receiver 
@@ -331,12 +896,14 @@ void Receiver_ToLowerLayer(struct packet *pkt)
          generate_msg() for testing. */
 void Receiver_ToUpperLayer(struct message *msg)
 {
-    static char cnt = 0;
+    Partition *part = cur_part;
+    Flow *flow = part->cur_flow;
+    char &cnt = flow->verify_cnt;
 
     for (int i=0; i<msg->size; i++) {
 	/* message verification */
 	if (msg->data[i] != '0' + cnt) {
-	    message_verfication_passed = false;
+	    flow->message_verfication_passed = false;
 	}
 	cnt = (cnt+1) % 10;
 
@@ -344,101 +911,79 @@ void Receiver_ToUpperLayer(struct message *msg)
 	    fputc(msg->data[i], stdout);
     }
 
-    tot_chars_delivered += msg->size;
+    flow->tot_chars_delivered += msg->size;
+    part->trace(TRACE_RECEIVER_TOUPPERLAYER, msg->size, 0);
+
+    /* the messages generated are delivered once all their characters are,
+       the rdt layer may split and join them */
+    double now = part->sim_core.time();
+    while (!flow->pending_msgs.empty() && 
+	   flow->pending_msgs.front().first<=flow->tot_chars_delivered) {
+	part->latency.record((uint64_t)((now - flow->pending_msgs.front().second)*1e6 + 0.5));
+	flow->pending_msgs.pop_front();
+	flow->tot_msgs_delivered ++;
+    }
+
+    size_t window = (size_t)(now/stats_interval);
+    if (window>=part->window_chars.size())
+	part->window_chars.resize(window+1, 0);
+    part->window_chars[window] += msg->size;
 }
 
 
 /*[]------------------------------------------------------------------------[]
-  |  main simulation control routine
+  |  main simulation cycle
   []------------------------------------------------------------------------[]*/
 
-int main(int argc, char *argv[])
+static double WallClock()
 {
-    if (argc!=8) {
-	fprintf(stderr, "usage: %s <sim_time> <mean_msg_arrivalint> <mean_msg_size> "
-		"<outoforder_rate> <loss_rate> <corrupt_rate> <tracing_level>\n", 
-		argv[0]);
-	exit(-1);
-    }
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec/1e6;
+}
 
-    sim_time = atof(argv[1]);
-    if (sim_time<=0) {
-	fprintf(stderr, "invalid <sim_time>\n");
-	exit(-1);
-    }
-    msg_arrivalint = atof(argv[2]);
-    if (msg_arrivalint<=0) {
-	fprintf(stderr, "invalid <msg_arrivalint>\n");
-	exit(-1);
-    }
-    msg_size = atoi(argv[3]);
-    if (msg_size<=0) {
-	fprintf(stderr, "invalid <msg_size>\n");
-	exit(-1);
-    }
-    outoforder_rate = atof(argv[4]);
-    if (outoforder_rate<0 || outoforder_rate>1) {
-	fprintf(stderr, "invalid <outoforder_rate>\n");
-	exit(-1);
-    }
-    loss_rate = atof(argv[5]);
-    if (loss_rate<0 || loss_rate>1) {
-	fprintf(stderr, "invalid <loss_rate>\n");
-	exit(-1);
-    }
-    corrupt_rate = atof(argv[6]);
-    if (corrupt_rate<0 || corrupt_rate>1) {
-	fprintf(stderr, "invalid <corrupt_rate>\n");
-	exit(-1);
+/* intialize the sender and the receiver of the flows of a partition, keeping
+   the contexts the rdt layer creates */
+static void InitFlows(Partition *part)
+{
+    cur_part = part;
+    for (size_t f=0; f<part->flows.size(); f++) {
+	Flow *flow = part->flows[f];
+	part->cur_flow = flow;
+	Sender_Init();
+	flow->sender_context = Sender_GetContext();
+	Receiver_Init();
+	flow->receiver_context = Receiver_GetContext();
+
+	/* scheduling a recurring message arrival event */
+	flow->msg_arrival.sched_time = 0;
+	part->sim_core.schedule(&flow->msg_arrival);
     }
-    tracing_level = atoi(argv[7]);
-    if (tracing_level<0 || tracing_level>2) {
-	fprintf(stderr, "invalid <tracing_level>\n");
-	exit(-1);
+    part->cur_flow = NULL;
+}
+
+/* finalize the sender and the receiver of the flows of a partition */
+static void FinalFlows(Partition *part)
+{
+    for (size_t f=0; f<part->flows.size(); f++) {
+	part->enter(part->flows[f]);
+	Sender_Final();
+	Receiver_Final();
     }
-    
-    fprintf(stdout, "## Reliable data transfer simulation with:\n"
-	    "\tsimulation time is %.3f seconds\n"
-	    "\taverage message arrival interval is %.3f seconds\n"
-	    "\taverage message size is %d bytes\n"
-	    "\taverage out-of-order delivery rate is %.2f%%\n"
-	    "\taverage loss rate is %.2f%%\n"
-	    "\taverage corrupt rate is %.2f%%\n"
-	    "\ttracing level is %d\n"
-	    "Please review these inputs and press <enter> to proceed.\n",
-	    sim_time, msg_arrivalint, msg_size, outoforder_rate*100.0, 
-	    loss_rate*100.0, corrupt_rate*100.0, tracing_level);
-    fgetc(stdin);
+    part->cur_flow = NULL;
+    cur_part = NULL;
+}
 
-    /* initialize the random number generator */
-    srand(getpid()+getppid());
-
-    /* test the random number generator */
-    double randtest_sum = 0.0;
-    for (int i=0; i<1000; i++)
-	randtest_sum += myrandom();
-    double randtest_avg = randtest_sum/1000;
-    if (randtest_avg<0.25 || randtest_avg>0.75) {
-	fprintf(stderr, 
-		"It appears that something is wrong with the random number.\n"
-		"Please try to run this again.\n"  
-		"Please report to me if the problem PERSISTS.\n");
-	exit(-1);
-    }
-
-    /* intialize the sender and the receiver */
-    Sender_Init();
-    Receiver_Init();
-
-    /* scheduling a recurring message arrival event */
-    EventSenderFromUpperLayer *e = new EventSenderFromUpperLayer;
-    e->sched_time = 0;
-    sim_core.schedule(e);
+/* process the events of a partition that happen before time until */
+static void RunPartition(Partition *part, double until)
+{
+    EventChain &sim_core = part->sim_core;
 
     /* main simulation cycle */
     for (;;) {
-	Event *e = sim_core.next_event();
+	Event *e = sim_core.next_event(until);
 	if (e==NULL) break;
+	part->tot_events++;
 
 	switch (e->event_type) {
 	case EVENT_SENDER_FROMUPPERLAYER:
@@ -448,19 +993,19 @@ int main(int argc, char *argv[])
 		}
 
 		EventSenderFromUpperLayer *real_e = (EventSenderFromUpperLayer*) e;
+		part->enter(real_e->flow);
 
 		struct message *msg = generate_msg();
+		part->trace(TRACE_SENDER_FROMUPPERLAYER, msg->size, 0);
 		Sender_FromUpperLayer(msg);
 		free_msg(msg);
 
 		/* schedule the recurring event */
 		if (sim_core.time() < sim_time) {
 		    real_e->sched_time = 
-			sim_core.time() + msg_arrivalint*2.0*myrandom();
+			sim_core.time() + part->sim->config->msg_arrivalint*2.0*myrandom(RAND_MSG);
 		    sim_core.schedule(real_e);
 		}
-		else
-		    delete real_e;
 	    }
 	    break;
 
@@ -471,10 +1016,12 @@ int main(int argc, char *argv[])
 		}
 
 		EventSenderFromLowerLayer *real_e = (EventSenderFromLowerLayer*) e;
+		part->enter(real_e->flow);
+		part->trace(TRACE_SENDER_FROMLOWERLAYER, real_e->trace_id, real_e->trace_outcome);
 
 		Sender_FromLowerLayer(&real_e->pkt);
 
-		delete real_e;
+		part->sender_pkt_events.put(real_e);
 	    }
 	    break;
 
@@ -484,10 +1031,8 @@ int main(int argc, char *argv[])
 		    fprintf(stdout, "Time %.2fs (Sender): the timer expires.\n", sim_core.time());
 		}
 
-		EventSenderTimeout *real_e = (EventSenderTimeout*) e;
-		delete real_e;
-		sender_timer = NULL;
-
+		part->enter(((EventSenderTimeout*) e)->flow);
+		part->trace(TRACE_SENDER_TIMEOUT, -1, 0);
 		Sender_Timeout();
 	    }
 	    break;
@@ -499,31 +1044,1020 @@ int main(int argc, char *argv[])
 		}
 
 		EventReceiverFromLowerLayer *real_e = (EventReceiverFromLowerLayer*) e;
-		
+		part->enter(real_e->flow);
+		part->trace(TRACE_RECEIVER_FROMLOWERLAYER, real_e->trace_id, real_e->trace_outcome);
+
 		Receiver_FromLowerLayer(&real_e->pkt);
 
-		delete real_e;
+		part->receiver_pkt_events.put(real_e);
+	    }
+	    break;
+
+	case EVENT_RECEIVER_TIMEOUT:
+	    {
+		if (tracing_level>=1) {
+		    fprintf(stdout, "Time %.2fs (Receiver): the timer expires.\n", sim_core.time());
+		}
+
+		part->enter(((EventReceiverTimeout*) e)->flow);
+		part->trace(TRACE_RECEIVER_TIMEOUT, -1, 0);
+		Receiver_Timeout();
 	    }
 	    break;
 
 	default:
 	    fprintf(stderr, "undefined event %d\n", e->event_type);
-	    break;
+	    continue;
+	}
+	part->cur_flow->end_time = sim_core.time();
+    }
+}
+
+/* a barrier the threads of a parallel run meet at, the last one to arrive
+   runs the serial part before the others go on */
+class Barrier
+{
+public:
+    std::mutex lock;
+    std::condition_variable cond;
+    int threads;
+    int waiting;
+    unsigned long generation;
+
+public:
+    Barrier(int n) { threads = n; waiting = 0; generation = 0; }
+
+    template <class F>
+    void wait(F serial) {
+	std::unique_lock<std::mutex> guard(lock);
+	unsigned long gen = generation;
+	if (++waiting==threads) {
+	    serial();
+	    waiting = 0;
+	    generation++;
+	    cond.notify_all();
+	}
+	else {
+	    while (gen==generation)
+		cond.wait(guard);
+	}
+    }
+};
+
+/* a simulation whose flows are partitioned over threads.  the partitions 
+   go on in windows of simulated time, conservatively: no event of a window
+   can cause an event in another partition within the window, because the 
+   flows only meet on a shared link and a packet passed to it arrives at
+   least lookahead later.  between the windows the shared link goes over the
+   packets of all partitions in the order the sequential core would pass 
+   them, and the next window starts at the earliest pending event (YAWNS). */
+struct ParallelRun
+{
+    Simulation *sim;
+    std::vector<Partition*> parts;
+    Barrier barrier;
+    double window_end;      /* the events before it can be processed */
+    bool done;
+    std::vector<LinkPacket> link_packets;
+
+    ParallelRun(Simulation *s, int n) : barrier(n) {
+	sim = s;
+	window_end = 0;
+	done = false;
+    }
+};
+
+static bool LinkPacketBefore(const LinkPacket &a, const LinkPacket &b)
+{
+    if (a.time!=b.time) return a.time<b.time;
+    return a.seq<b.seq;
+}
+
+/* the serial part between two windows */
+static void EndWindow(ParallelRun *run)
+{
+    Simulation *sim = run->sim;
+
+    /* the packets passed to the shared link in the window */
+    run->link_packets.clear();
+    for (size_t p=0; p<run->parts.size(); p++) {
+	std::vector<LinkPacket> &packets = run->parts[p]->link_packets;
+	run->link_packets.insert(run->link_packets.end(), packets.begin(), packets.end());
+	packets.clear();
+    }
+    std::sort(run->link_packets.begin(), run->link_packets.end(), LinkPacketBefore);
+
+    for (size_t i=0; i<run->link_packets.size(); i++) {
+	LinkPacket &p = run->link_packets[i];
+	Partition *part = run->parts[p.flow->partition];
+	Event *e;
+	if (p.ack)
+	    e = PassPacket(part, p.flow, p.time, true, &part->sender_pkt_events, &p.pkt, -1, 0);
+	else
+	    e = PassPacket(part, p.flow, p.time, false, &part->receiver_pkt_events, &p.pkt, -1, 0);
+	if (e==NULL) continue;
+
+	if (e->sched_time<run->window_end) {
+	    fprintf(stderr, "packet of flow %d arrives at %.9fs, within the window ending at %.9fs\n",
+		    p.flow->id, e->sched_time, run->window_end);
+	    abort();
+	}
+	part->sim_core.schedule(e, p.seq);
+    }
+
+    /* the next window */
+    double start = HUGE_VAL;
+    for (size_t p=0; p<run->parts.size(); p++)
+	start = std::min(start, run->parts[p]->sim_core.next_time());
+    if (start==HUGE_VAL) {
+	run->done = true;
+	return;
+    }
+    run->window_end = start + sim->lookahead;
+    sim->windows++;
+}
+
+static void PartitionWorker(ParallelRun *run, int p)
+{
+    Partition *part = run->parts[p];
+
+    InitFlows(part);
+    cur_part = NULL;
+    for (;;) {
+	run->barrier.wait([run]() { EndWindow(run); });
+	if (run->done) break;
+
+	cur_part = part;
+	RunPartition(part, run->window_end);
+	cur_part = NULL;
+    }
+    cur_part = part;
+    FinalFlows(part);
+}
+
+/* the least time a packet passed to the shared link takes to arrive, which
+   is how far the partitions of a parallel run can go on on their own, 0 if 
+   they can not.  a link with no queue and no bursty loss has no state and 
+   does not tie the flows together. */
+static double Lookahead(const SimConfig *config)
+{
+    if (!shared_link || (link_bandwidth<=0 && burst_enter<=0))
+	return HUGE_VAL;
+
+    /* reordered packets may arrive right after they leave the queue.  a 
+       little is taken off so that rounding does not make a packet arrive 
+       just within the window */
+    double least = (config->outoforder_rate>0) ? 0 : pkt_latency;
+    if (link_bandwidth>0)
+	least += RDT_PKTSIZE*8.0/link_bandwidth;
+    return least*(1-1e-9);
+}
+
+/* run a simulation to its end, with its flows partitioned over the given
+   number of threads */
+static void RunSimulation(Simulation *sim, int threads)
+{
+    double start = WallClock();
+
+    /* without a lookahead the flows stay in one partition */
+    threads = std::min(threads, num_flows);
+    sim->lookahead = Lookahead(sim->config);
+    if (sim->lookahead<=0)
+	threads = 1;
+    sim->threads = threads;
+
+    /* the flows in contiguous blocks */
+    std::vector<Partition*> parts;
+    for (int p=0; p<threads; p++)
+	parts.push_back(new Partition(sim));
+    for (int f=0; f<num_flows; f++) {
+	Flow *flow = &sim->flows[f];
+	flow->partition = (int)((long)f*threads/num_flows);
+	parts[flow->partition]->flows.push_back(flow);
+    }
+
+    if (threads==1) {
+	InitFlows(parts[0]);
+	RunPartition(parts[0], HUGE_VAL);
+	FinalFlows(parts[0]);
+    }
+    else {
+	ParallelRun run(sim, threads);
+	run.parts = parts;
+	for (int p=0; p<threads; p++)
+	    parts[p]->defer_link = (sim->lookahead<HUGE_VAL);
+
+	std::vector<std::thread> workers;
+	for (int p=1; p<threads; p++)
+	    workers.push_back(std::thread(PartitionWorker, &run, p));
+	PartitionWorker(&run, 0);
+	for (size_t i=0; i<workers.size(); i++)
+	    workers[i].join();
+    }
+
+    /* sum up the statistics of the flows and of the partitions */
+    for (int f=0; f<num_flows; f++) {
+	Flow *flow = &sim->flows[f];
+	sim->tot_data_sent += flow->tot_data_sent;
+	sim->tot_retransmissions += flow->tot_retransmissions;
+	sim->tot_repair_sent += flow->tot_repair_sent;
+	sim->tot_chars_sent += flow->tot_chars_sent;
+	sim->tot_chars_delivered += flow->tot_chars_delivered;
+	sim->tot_msgs_sent += flow->tot_msgs_sent;
+	sim->tot_msgs_delivered += flow->tot_msgs_delivered;
+	sim->tot_pkts_passed += flow->tot_pkts_passed;
+	sim->tot_acks_passed += flow->tot_acks_passed;
+	if (!flow->message_verfication_passed)
+	    sim->message_verfication_passed = false;
+    }
+    for (int p=0; p<threads; p++) {
+	Partition *part = parts[p];
+	sim->tot_events += part->tot_events;
+	sim->end_time = std::max(sim->end_time, part->sim_core.time());
+	sim->arm_cnt += part->sim_core.arm_cnt;
+	sim->stale_cnt += part->sim_core.stale_cnt;
+	sim->event_stats.allocated += part->event_stats.allocated;
+	sim->event_stats.recycled += part->event_stats.recycled;
+	sim->event_stats.peak_live = std::max(sim->event_stats.peak_live, part->event_stats.peak_live);
+	sim->peak_live.push_back(part->event_stats.peak_live);
+	sim->latency.merge(part->latency);
+	if (part->window_chars.size()>sim->window_chars.size())
+	    sim->window_chars.resize(part->window_chars.size(), 0);
+	for (size_t w=0; w<part->window_chars.size(); w++)
+	    sim->window_chars[w] += part->window_chars[w];
+	delete part;
+    }
+    sim->wall_time = WallClock() - start;
+}
+
+/* jain's fairness index of the values, 1 if they are all equal down to 1/n
+   if one of them takes everything */
+static double JainIndex(const std::vector<double> &x)
+{
+    double sum = 0, sum_sq = 0;
+    for (size_t i=0; i<x.size(); i++) {
+	sum += x[i];
+	sum_sq += x[i]*x[i];
+    }
+    return (sum_sq>0) ? sum*sum/(x.size()*sum_sq) : 1;
+}
+
+/* write the statistics of a finished simulation as a JSON object */
+static void WriteStats(Simulation *sim, FILE *file)
+{
+    double end_time = sim->end_time;
+    int data_passed = sim->tot_pkts_passed - sim->tot_acks_passed;
+    const Histogram &h = sim->latency;
+
+    fprintf(file, "{\n"
+	    "  \"sim_time\": %.6f,\n"
+	    "  \"flows\": %d,\n"
+	    "  \"passed\": %s,\n"
+	    "  \"chars_sent\": %d,\n"
+	    "  \"chars_delivered\": %d,\n"
+	    "  \"goodput\": %.2f,\n"
+	    "  \"messages_sent\": %d,\n"
+	    "  \"messages_delivered\": %d,\n",
+	    end_time, num_flows, sim->passed() ? "true" : "false",
+	    sim->tot_chars_sent, sim->tot_chars_delivered,
+	    (end_time>0) ? sim->tot_chars_delivered/end_time : 0,
+	    sim->tot_msgs_sent, sim->tot_msgs_delivered);
+
+    /* latencies in milliseconds, the buckets with their highest value */
+    fprintf(file, "  \"latency_ms\": {\n"
+	    "    \"count\": %llu,\n"
+	    "    \"min\": %.3f,\n"
+	    "    \"mean\": %.3f,\n"
+	    "    \"p50\": %.3f,\n"
+	    "    \"p90\": %.3f,\n"
+	    "    \"p99\": %.3f,\n"
+	    "    \"p999\": %.3f,\n"
+	    "    \"max\": %.3f,\n"
+	    "    \"histogram\": [",
+	    (unsigned long long)h.total, h.min/1e3, h.mean()/1e3,
+	    h.percentile(0.5)/1e3, h.percentile(0.9)/1e3,
+	    h.percentile(0.99)/1e3, h.percentile(0.999)/1e3, h.max/1e3);
+    bool first = true;
+    for (size_t i=0; i<h.counts.size(); i++) {
+	if (h.counts[i]==0) continue;
+	fprintf(file, "%s[%.3f, %llu]", first ? "" : ", ",
+		Histogram::highest(i)/1e3, (unsigned long long)h.counts[i]);
+	first = false;
+    }
+    fprintf(file, "]\n  },\n");
+
+    /* goodput of each window, the last one may be cut short */
+    fprintf(file, "  \"goodput_interval\": %.6f,\n"
+	    "  \"goodput_over_time\": [", stats_interval);
+    for (size_t w=0; w<sim->window_chars.size(); w++) {
+	double length = std::min(stats_interval, end_time - w*stats_interval);
+	fprintf(file, "%s%.2f", (w>0) ? ", " : "",
+		(length>0) ? sim->window_chars[w]/length : 0);
+    }
+    fprintf(file, "],\n");
+
+    fprintf(file, "  \"data_packets_sent\": %d,\n"
+	    "  \"retransmissions\": %d,\n"
+	    "  \"retransmission_ratio\": %.6f,\n"
+	    "  \"repair_packets_sent\": %d,\n"
+	    "  \"packets_passed\": %d,\n"
+	    "  \"acks_passed\": %d,\n"
+	    "  \"acks_per_data_packet\": %.6f,\n"
+	    "  \"ack_share\": %.6f,\n"
+	    "  \"chars_per_packet\": %.3f,\n"
+	    "  \"events\": %llu,\n"
+	    "  \"wall_time\": %.6f,\n",
+	    sim->tot_data_sent, sim->tot_retransmissions,
+	    (sim->tot_data_sent>0) ? (double)sim->tot_retransmissions/sim->tot_data_sent : 0,
+	    sim->tot_repair_sent, sim->tot_pkts_passed, sim->tot_acks_passed,
+	    (data_passed>0) ? (double)sim->tot_acks_passed/data_passed : 0,
+	    (sim->tot_pkts_passed>0) ? (double)sim->tot_acks_passed/sim->tot_pkts_passed : 0,
+	    (sim->tot_pkts_passed>0) ? (double)sim->tot_chars_delivered/sim->tot_pkts_passed : 0,
+	    sim->tot_events, sim->wall_time);
+
+    /* the partitions peak at different times, their peaks are not summed */
+    fprintf(file, "  \"peak_live_events\": [");
+    for (size_t p=0; p<sim->peak_live.size(); p++)
+	fprintf(file, "%s%ld", (p>0) ? ", " : "", sim->peak_live[p]);
+    fprintf(file, "]\n}\n");
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  batch of independent simulations
+  []------------------------------------------------------------------------[]*/
+
+/* outcome of one run of a batch */
+struct SimResult
+{
+    bool passed;
+    double throughput;      /* packets passed per simulated second */
+    double goodput;         /* characters delivered per simulated second */
+    int pkts_passed;
+    int chars_delivered;
+    int retransmissions;
+    unsigned long long events;
+    double wall_time;
+    Histogram latency;      /* of the messages, in microseconds */
+};
+
+/* runs of a batch handed out to the worker threads, each with its own
+   generator and parameters */
+struct Batch
+{
+    int runs;
+    std::vector<Random> generators;
+    std::vector<const SimConfig*> configs;
+    std::atomic<int> next_run;
+    std::vector<SimResult> results;
+};
+
+static void BatchWorker(Batch *batch)
+{
+    for (;;) {
+	int run = batch->next_run++;
+	if (run>=batch->runs) break;
+
+	Simulation sim(batch->generators[run], true, batch->configs[run]);
+	RunSimulation(&sim, 1);
+
+	double end_time = sim.end_time;
+	SimResult &res = batch->results[run];
+	res.passed = sim.passed();
+	res.throughput = (end_time>0) ? sim.tot_pkts_passed/end_time : 0;
+	res.goodput = (end_time>0) ? sim.tot_chars_delivered/end_time : 0;
+	res.pkts_passed = sim.tot_pkts_passed;
+	res.chars_delivered = sim.tot_chars_delivered;
+	res.retransmissions = sim.tot_retransmissions;
+	res.events = sim.tot_events;
+	res.wall_time = sim.wall_time;
+	res.latency = sim.latency;
+    }
+}
+
+/* run all the runs of a batch on the threads, return the time it takes */
+static double RunJobs(Batch *batch, int threads)
+{
+    batch->next_run = 0;
+    batch->results.resize(batch->runs);
+
+    double start = WallClock();
+    std::vector<std::thread> workers;
+    for (int i=0; i<threads; i++)
+	workers.push_back(std::thread(BatchWorker, batch));
+    for (int i=0; i<threads; i++)
+	workers[i].join();
+    return WallClock() - start;
+}
+
+/* the value below which a fraction p of the sorted values fall */
+static double Percentile(const std::vector<double> &sorted, double p)
+{
+    size_t i = (size_t)(p*(sorted.size()-1) + 0.5);
+    return sorted[i];
+}
+
+/* run a batch of independent simulations over all cores and report how many
+   of them are error-free */
+static void RunBatch(const SimConfig *config, int runs, int threads)
+{
+    Batch batch;
+    batch.runs = runs;
+
+    /* the same generators RunGenerator() gives, without jumping from the 
+       seed for every run */
+    Random rng(rand_seed);
+    for (int i=0; i<runs; i++) {
+	batch.generators.push_back(rng);
+	batch.configs.push_back(config);
+	rng.long_jump();
+    }
+
+    double elapsed = RunJobs(&batch, threads);
+
+    int passed = 0;
+    std::vector<double> throughput, goodput;
+    Histogram latency;
+    for (int i=0; i<runs; i++) {
+	if (batch.results[i].passed) passed++;
+	throughput.push_back(batch.results[i].throughput);
+	goodput.push_back(batch.results[i].goodput);
+	latency.merge(batch.results[i].latency);
+    }
+    std::sort(throughput.begin(), throughput.end());
+    std::sort(goodput.begin(), goodput.end());
+
+    fprintf(stdout, "## Batch of %d simulations completed in %.2fs on %d threads with\n"
+	    "\trandom seed %llu\n"
+	    "\t%d passed\n"
+	    "\t%d failed\n",
+	    runs, elapsed, threads, (unsigned long long)rand_seed, passed, 
+	    runs-passed);
+    for (int i=0; i<runs; i++)
+	if (!batch.results[i].passed)
+	    fprintf(stdout, "\trun %d failed, replay it with --seed=%llu --run=%d\n", 
+		    i, (unsigned long long)rand_seed, i);
+
+    fprintf(stdout, "\t%-32s %12s %12s %12s %12s %12s\n",
+	    "percentile", "p1", "p10", "p50", "p90", "p99");
+    fprintf(stdout, "\t%-32s %12.2f %12.2f %12.2f %12.2f %12.2f\n",
+	    "throughput (packets/s)",
+	    Percentile(throughput, 0.01), Percentile(throughput, 0.10),
+	    Percentile(throughput, 0.50), Percentile(throughput, 0.90),
+	    Percentile(throughput, 0.99));
+    fprintf(stdout, "\t%-32s %12.2f %12.2f %12.2f %12.2f %12.2f\n",
+	    "goodput (characters/s)",
+	    Percentile(goodput, 0.01), Percentile(goodput, 0.10),
+	    Percentile(goodput, 0.50), Percentile(goodput, 0.90),
+	    Percentile(goodput, 0.99));
+    fprintf(stdout, "\t%-32s %12.2f %12.2f %12.2f %12.2f %12.2f\n",
+	    "message latency (ms, all runs)",
+	    latency.percentile(0.01)/1e3, latency.percentile(0.10)/1e3,
+	    latency.percentile(0.50)/1e3, latency.percentile(0.90)/1e3,
+	    latency.percentile(0.99)/1e3);
+
+    if (passed==runs)
+	fprintf(stdout, "## Congratulations! All sessions are error-free, loss-free, and in order.\n");
+    else
+	fprintf(stdout, "## Something is wrong! %d/%d sessions are NOT error-free, loss-free, and in order.\n",
+		runs-passed, runs);
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  parameter sweeps
+  []------------------------------------------------------------------------[]*/
+
+/* one parameter of a sweep and the values it takes */
+struct SweepAxis
+{
+    std::string name;
+    std::vector<std::string> values;
+};
+
+/* parse name=<values>, where the values are a comma separated list of 
+   values and of ranges <from>:<to>:<step>, return false if it is malformed */
+static bool ParseSweep(const char *spec, SweepAxis *axis)
+{
+    const char *eq = strchr(spec, '=');
+    if (eq==NULL || eq==spec) return false;
+    axis->name.assign(spec, eq-spec);
+
+    std::string list(eq+1);
+    size_t pos = 0;
+    while (pos<=list.size()) {
+	size_t end = list.find(',', pos);
+	if (end==std::string::npos) end = list.size();
+	std::string item = list.substr(pos, end-pos);
+	pos = end+1;
+	if (item.empty()) return false;
+
+	if (item.find(':')==std::string::npos) {
+	    axis->values.push_back(item);
+	    continue;
+	}
+	double from, to, step;
+	if (sscanf(item.c_str(), "%lf:%lf:%lf", &from, &to, &step)!=3 ||
+	    step<=0 || to<from)
+	    return false;
+	for (int i=0; from+i*step<=to+step*1e-9; i++) {
+	    char value[32];
+	    snprintf(value, sizeof(value), "%g", from+i*step);
+	    axis->values.push_back(value);
+	}
+    }
+    return true;
+}
+
+/* set a parameter of a configuration.  the parameters of the simulator are
+   checked here, the values of a switch of the rdt layer are checked by the
+   rdt layer when it starts.  the other switches of the simulator hold for
+   all the configurations, so they are no parameters */
+static bool SetParameter(SimConfig *config, const std::string &name, 
+			 const std::string &value)
+{
+    double x = atof(value.c_str());
+    if (name=="interval") {
+	config->msg_arrivalint = x;
+	return x>0;
+    }
+    if (name=="size") {
+	config->msg_size = atoi(value.c_str());
+	return config->msg_size>0;
+    }
+    if (name=="reorder") {
+	config->outoforder_rate = x;
+	return x>=0 && x<=1;
+    }
+    if (name=="loss") {
+	config->loss_rate = x;
+	return x>=0 && x<=1;
+    }
+    if (name=="corrupt") {
+	config->corrupt_rate = x;
+	return x>=0 && x<=1;
+    }
+    if (!IsSwitch(rdt_switches, name.c_str(), name.size()))
+	return false;
+    config->options.push_back(name + "=" + value);
+    return true;
+}
+
+/* run every combination of the values of the axes, each the given number of
+   runs with the generators of a batch, and print a CSV row per combination */
+static void RunSweep(const SimConfig *base, const std::vector<SweepAxis> &axes,
+		     int runs, int threads)
+{
+    /* the grid, the last axis varies fastest */
+    int nconfigs = 1;
+    for (size_t a=0; a<axes.size(); a++)
+	nconfigs *= axes[a].values.size();
+    std::vector<SimConfig> configs(nconfigs, *base);
+    std::vector<std::vector<int> > index(nconfigs, std::vector<int>(axes.size()));
+    for (int c=0; c<nconfigs; c++) {
+	int k = c;
+	for (int a=axes.size()-1; a>=0; a--) {
+	    int n = axes[a].values.size();
+	    index[c][a] = k%n;
+	    k /= n;
+	    if (!SetParameter(&configs[c], axes[a].name, axes[a].values[index[c][a]])) {
+		fprintf(stderr, "invalid --sweep=%s\n", axes[a].name.c_str());
+		exit(-1);
+	    }
+	}
+    }
+
+    /* every configuration sees the same random numbers */
+    std::vector<Random> generators;
+    Random rng(rand_seed);
+    for (int r=0; r<runs; r++) {
+	generators.push_back(rng);
+	rng.long_jump();
+    }
+
+    Batch batch;
+    batch.runs = nconfigs*runs;
+    for (int c=0; c<nconfigs; c++)
+	for (int r=0; r<runs; r++) {
+	    batch.generators.push_back(generators[r]);
+	    batch.configs.push_back(&configs[c]);
 	}
+    double elapsed = RunJobs(&batch, std::min(threads, batch.runs));
+
+    for (size_t a=0; a<axes.size(); a++)
+	fprintf(stdout, "%s,", axes[a].name.c_str());
+    fprintf(stdout, "runs,passed,goodput,throughput,pkts_passed,chars_per_pkt,"
+	    "retransmissions,p50_latency,p99_latency,events_per_sec,result\n");
+    int failed = 0;
+    for (int c=0; c<nconfigs; c++) {
+	int passed = 0;
+	double goodput = 0, throughput = 0, pkts = 0, retrans = 0, wall = 0;
+	unsigned long long events = 0, chars = 0, all_pkts = 0;
+	Histogram latency;
+	for (int r=0; r<runs; r++) {
+	    SimResult &res = batch.results[c*runs + r];
+	    latency.merge(res.latency);
+	    if (res.passed) passed++;
+	    goodput += res.goodput/runs;
+	    throughput += res.throughput/runs;
+	    pkts += (double)res.pkts_passed/runs;
+	    retrans += (double)res.retransmissions/runs;
+	    events += res.events;
+	    chars += res.chars_delivered;
+	    all_pkts += res.pkts_passed;
+	    wall += res.wall_time;
+	}
+	if (passed<runs) failed++;
+
+	for (size_t a=0; a<axes.size(); a++)
+	    fprintf(stdout, "%s,", axes[a].values[index[c][a]].c_str());
+	fprintf(stdout, "%d,%d,%.2f,%.2f,%.1f,%.2f,%.1f,%.3f,%.3f,%.0f,%s\n", runs, passed, 
+		goodput, throughput, pkts, 
+		(all_pkts>0) ? (double)chars/all_pkts : 0, retrans, 
+		latency.percentile(0.5)/1e3, latency.percentile(0.99)/1e3,
+		(wall>0) ? events/wall : 0, (passed==runs) ? "pass" : "fail");
     }
 
-    /* finalize the sender and the receiver */
-    Sender_Final();
-    Receiver_Final();
+    fprintf(stderr, "## Sweep of %d configurations, %d runs each, completed in %.2fs on %d threads, %d failed\n",
+	    nconfigs, runs, elapsed, std::min(threads, batch.runs), failed);
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  main simulation control routine
+  []------------------------------------------------------------------------[]*/
+
+int main(int argc, char *argv[])
+{
+    /* separate the switches from the positional arguments */
+    int nargs = 1;
+    for (int i=1; i<argc; i++) {
+	if (strncmp(argv[i], "--", 2)==0)
+	    sim_options.push_back(argv[i]);
+	else
+	    argv[nargs++] = argv[i];
+    }
+    argc = nargs;
+
+    /* a misspelt switch would silently be ignored */
+    for (size_t i=0; i<sim_options.size(); i++) {
+	const char *opt = sim_options[i]+2;
+	const char *eq = strchr(opt, '=');
+	if (eq==NULL || (!IsSwitch(sim_switches, opt, eq-opt) && 
+			 !IsSwitch(rdt_switches, opt, eq-opt))) {
+	    fprintf(stderr, "invalid %s\n", sim_options[i]);
+	    exit(-1);
+	}
+    }
+
+    if (argc!=8) {
+	fprintf(stderr, "usage: %s <sim_time> <mean_msg_arrivalint> <mean_msg_size> "
+		"<outoforder_rate> <loss_rate> <corrupt_rate> <tracing_level>\n"
+		"\t[--scheduler=list|heap[:arity]|wheel[:tick]]\n"
+		"\t[--seed=<seed>] [--run=<run>]\n"
+		"\t[--batch=<runs>] [--threads=<threads>]\n"
+		"\t[--arq=gbn|sr] [--rto=fixed|adaptive] [--timeout=<seconds>] [--rto-max=<seconds>]\n"
+		"\t[--rto-tune=on|off]\n"
+		"\t[--coalesce=on|off|nagle]\n"
+		"\t[--window=<pkts>] [--rwnd=<pkts>] [--cc=fixed|reno|cubic]\n"
+		"\t[--delack=<seconds>] [--delack-count=<pkts>]\n"
+		"\t[--bandwidth=<bits/s>] [--queue=<pkts>] [--aqm=droptail|red]\n"
+		"\t[--burst=<enter>,<leave>[,<loss>]]\n"
+		"\t[--flows=<flows>] [--link=separate|shared] [--parallel=<threads>]\n"
+		"\t[--trace=<file>]\n"
+		"\t[--stats=<file>] [--stats-interval=<seconds>]\n"
+		"\t[--sweep=interval|size|reorder|loss|corrupt|<switch>=<values>]...\n",
+		argv[0]);
+	exit(-1);
+    }
+
+    sim_time = atof(argv[1]);
+    if (sim_time<=0) {
+	fprintf(stderr, "invalid <sim_time>\n");
+	exit(-1);
+    }
+    msg_arrivalint = atof(argv[2]);
+    if (msg_arrivalint<=0) {
+	fprintf(stderr, "invalid <msg_arrivalint>\n");
+	exit(-1);
+    }
+    msg_size = atoi(argv[3]);
+    if (msg_size<=0) {
+	fprintf(stderr, "invalid <msg_size>\n");
+	exit(-1);
+    }
+    outoforder_rate = atof(argv[4]);
+    if (outoforder_rate<0 || outoforder_rate>1) {
+	fprintf(stderr, "invalid <outoforder_rate>\n");
+	exit(-1);
+    }
+    loss_rate = atof(argv[5]);
+    if (loss_rate<0 || loss_rate>1) {
+	fprintf(stderr, "invalid <loss_rate>\n");
+	exit(-1);
+    }
+    corrupt_rate = atof(argv[6]);
+    if (corrupt_rate<0 || corrupt_rate>1) {
+	fprintf(stderr, "invalid <corrupt_rate>\n");
+	exit(-1);
+    }
+    tracing_level = atoi(argv[7]);
+    if (tracing_level<0 || tracing_level>2) {
+	fprintf(stderr, "invalid <tracing_level>\n");
+	exit(-1);
+    }
+    scheduler_spec = GetOption("scheduler", "heap");
+    Scheduler *backend = CreateScheduler(scheduler_spec);
+    if (backend==NULL) {
+	fprintf(stderr, "invalid --scheduler\n");
+	exit(-1);
+    }
+    delete backend;
+    int batch_runs = atoi(GetOption("batch", "0"));
+    if (batch_runs<0) {
+	fprintf(stderr, "invalid --batch\n");
+	exit(-1);
+    }
+    int batch_threads = atoi(GetOption("threads", "0"));
+    if (batch_threads<=0)
+	batch_threads = std::max(1, (int)std::thread::hardware_concurrency());
+
+    /* link model */
+    link_bandwidth = atof(GetOption("bandwidth", "0"));
+    if (link_bandwidth<0) {
+	fprintf(stderr, "invalid --bandwidth\n");
+	exit(-1);
+    }
+    queue_limit = atoi(GetOption("queue", "100"));
+    if (queue_limit<1) {
+	fprintf(stderr, "invalid --queue\n");
+	exit(-1);
+    }
+    const char *aqm = GetOption("aqm", "droptail");
+    if (strcmp(aqm, "droptail")!=0 && strcmp(aqm, "red")!=0) {
+	fprintf(stderr, "invalid --aqm\n");
+	exit(-1);
+    }
+    red_queue = (strcmp(aqm, "red")==0);
+    burst_loss = 1;
+    const char *burst = GetOption("burst", NULL);
+    if (burst!=NULL) {
+	if (sscanf(burst, "%lf,%lf,%lf", &burst_enter, &burst_leave, &burst_loss)<2 ||
+	    burst_enter<=0 || burst_enter>1 || burst_leave<=0 || burst_leave>1 ||
+	    burst_loss<0 || burst_loss>1) {
+	    fprintf(stderr, "invalid --burst\n");
+	    exit(-1);
+	}
+    }
+
+    /* flows */
+    num_flows = atoi(GetOption("flows", "1"));
+    if (num_flows<1) {
+	fprintf(stderr, "invalid --flows\n");
+	exit(-1);
+    }
+    const char *link = GetOption("link", "separate");
+    if (strcmp(link, "separate")!=0 && strcmp(link, "shared")!=0) {
+	fprintf(stderr, "invalid --link\n");
+	exit(-1);
+    }
+    shared_link = (strcmp(link, "shared")==0);
+    sim_threads = atoi(GetOption("parallel", "1"));
+    if (sim_threads<1) {
+	fprintf(stderr, "invalid --parallel\n");
+	exit(-1);
+    }
+    /* sweep axes, --sweep may be given once for each */
+    std::vector<SweepAxis> sweep;
+    for (size_t i=0; i<sim_options.size(); i++) {
+	if (strncmp(sim_options[i], "--sweep=", 8)!=0) continue;
+	SweepAxis axis;
+	if (!ParseSweep(sim_options[i]+8, &axis)) {
+	    fprintf(stderr, "invalid --sweep\n");
+	    exit(-1);
+	}
+	sweep.push_back(axis);
+    }
+
+    trace_path = GetOption("trace", NULL);
+    if (trace_path!=NULL && (batch_runs>0 || !sweep.empty())) {
+	fprintf(stderr, "invalid --trace, a batch is not traced\n");
+	exit(-1);
+    }
+    if (sim_threads>1 && (batch_runs>0 || !sweep.empty())) {
+	fprintf(stderr, "invalid --parallel, the runs of a batch go on in parallel already\n");
+	exit(-1);
+    }
+    if (sim_threads>1 && (trace_path!=NULL || tracing_level>0)) {
+	fprintf(stderr, "invalid --parallel, a traced simulation runs on one thread\n");
+	exit(-1);
+    }
+    stats_path = GetOption("stats", NULL);
+    if (stats_path!=NULL && (batch_runs>0 || !sweep.empty())) {
+	fprintf(stderr, "invalid --stats, a batch has no statistics file\n");
+	exit(-1);
+    }
+    stats_interval = atof(GetOption("stats-interval", "1"));
+    if (stats_interval<=0) {
+	fprintf(stderr, "invalid --stats-interval\n");
+	exit(-1);
+    }
+
+    /* initialize the random number generator */
+    const char *seed = GetOption("seed", NULL);
+    if (seed!=NULL)
+	rand_seed = strtoull(seed, NULL, 0);
+    else
+	rand_seed = getpid()+getppid();
+    int run = atoi(GetOption("run", "0"));
+    if (run<0) {
+	fprintf(stderr, "invalid --run\n");
+	exit(-1);
+    }
+
+    /* test the random number generator */
+    Random randtest(rand_seed);
+    double randtest_sum = 0.0;
+    for (int i=0; i<1000; i++)
+	randtest_sum += randtest.uniform();
+    double randtest_avg = randtest_sum/1000;
+    if (randtest_avg<0.25 || randtest_avg>0.75) {
+	fprintf(stderr, 
+		"It appears that something is wrong with the random number.\n"
+		"Please try to run this again.\n"  
+		"Please report to me if the problem PERSISTS.\n");
+	exit(-1);
+    }
+
+    SimConfig config;
+    config.msg_arrivalint = msg_arrivalint;
+    config.msg_size = msg_size;
+    config.outoforder_rate = outoforder_rate;
+    config.loss_rate = loss_rate;
+    config.corrupt_rate = corrupt_rate;
+
+    /* a sweep runs --batch runs (at least one) of every configuration, 
+       quietly and without asking for confirmation */
+    if (!sweep.empty()) {
+	tracing_level = 0;
+	RunSweep(&config, sweep, std::max(1, batch_runs), batch_threads);
+	return 0;
+    }
+
+    /* a batch runs quietly and without asking for confirmation */
+    if (batch_runs>0) {
+	tracing_level = 0;
+	RunBatch(&config, batch_runs, std::min(batch_threads, batch_runs));
+	return 0;
+    }
+
+    fprintf(stdout, "## Reliable data transfer simulation with:\n"
+	    "\tsimulation time is %.3f seconds\n"
+	    "\taverage message arrival interval is %.3f seconds\n"
+	    "\taverage message size is %d bytes\n"
+	    "\taverage out-of-order delivery rate is %.2f%%\n"
+	    "\taverage loss rate is %.2f%%\n"
+	    "\taverage corrupt rate is %.2f%%\n"
+	    "\ttracing level is %d\n"
+	    "\tevent scheduler is %s\n"
+	    "\trandom seed is %llu (run %d)\n",
+	    sim_time, msg_arrivalint, msg_size, outoforder_rate*100.0, 
+	    loss_rate*100.0, corrupt_rate*100.0, tracing_level, scheduler_spec,
+	    (unsigned long long)rand_seed, run);
+    if (link_bandwidth>0)
+	fprintf(stdout, "\tlink bandwidth is %.0f bits/s with a %d-packet %s queue\n",
+		link_bandwidth, queue_limit, red_queue ? "RED" : "drop-tail");
+    if (burst_enter>0)
+	fprintf(stdout, "\tbursty loss enters/leaves the bad state at %.2f%%/%.2f%% and loses %.2f%% in it\n",
+		burst_enter*100.0, burst_leave*100.0, burst_loss*100.0);
+    if (num_flows>1)
+	fprintf(stdout, "\t%d flows over %s links\n", num_flows,
+		shared_link ? "shared" : "separate");
+    if (sim_threads>1)
+	fprintf(stdout, "\tthe flows are partitioned over up to %d threads\n", sim_threads);
+    if (trace_path!=NULL)
+	fprintf(stdout, "\tbinary trace is written to %s\n", trace_path);
+    if (stats_path!=NULL)
+	fprintf(stdout, "\tstatistics are written to %s\n", stats_path);
+    fprintf(stdout, "Please review these inputs and press <enter> to proceed.\n");
+    fgetc(stdin);
+
+    /* the rdt layers of many flows would drown the summary */
+    Simulation sim(RunGenerator(run), num_flows>1, &config);
+    TraceWriter tracer;
+    if (trace_path!=NULL) {
+	if (!tracer.open(trace_path)) {
+	    fprintf(stderr, "invalid --trace, can not create %s\n", trace_path);
+	    exit(-1);
+	}
+	sim.tracer = &tracer;
+    }
+    RunSimulation(&sim, sim_threads);
+    tracer.close();
 
     fprintf(stdout, "\n");
     fprintf(stdout, "## Simulation completed at time %.2fs with\n" 
 	    "\t%d characters sent\n" 
 	    "\t%d characters delivered\n"
-	    "\t%d packets passed between the sender and the receiver\n", 
-	    sim_core.time(), tot_chars_sent, tot_chars_delivered, tot_pkts_passed);
+	    "\t%d packets passed between the sender and the receiver (%d acks)\n"
+	    "\t%d data packets retransmitted\n"
+	    "\t%.2f characters delivered per second (goodput)\n"
+	    "\t%.2f characters delivered per packet passed\n"
+	    "\t%ld event allocations avoided (%ld allocated, peak of %ld live events%s)\n"
+	    "\t%llu timer re-arms (%.2f per simulated second), %llu stale expirations skipped\n"
+	    "\t%llu events processed in %.2fs (%.0f events/s)\n", 
+	    sim.end_time, sim.tot_chars_sent, sim.tot_chars_delivered,
+	    sim.tot_pkts_passed, sim.tot_acks_passed, sim.tot_retransmissions,
+	    (sim.end_time>0) ? sim.tot_chars_delivered/sim.end_time : 0,
+	    (sim.tot_pkts_passed>0) ? (double)sim.tot_chars_delivered/sim.tot_pkts_passed : 0,
+	    sim.event_stats.recycled,
+	    sim.event_stats.allocated, sim.event_stats.peak_live,
+	    (sim.threads>1) ? " in the busiest thread" : "",
+	    (unsigned long long)sim.arm_cnt,
+	    (sim.end_time>0) ? sim.arm_cnt/sim.end_time : 0,
+	    (unsigned long long)sim.stale_cnt,
+	    sim.tot_events, sim.wall_time,
+	    (sim.wall_time>0) ? sim.tot_events/sim.wall_time : 0);
+    fprintf(stdout, "\t%d of %d messages delivered, latency p50 %.2fms, p99 %.2fms, p99.9 %.2fms, max %.2fms\n"
+	    "\t%.2f%% of the data packets sent are retransmissions, %.2f%% of the packets passed are acks\n",
+	    sim.tot_msgs_delivered, sim.tot_msgs_sent,
+	    sim.latency.percentile(0.5)/1e3, sim.latency.percentile(0.99)/1e3,
+	    sim.latency.percentile(0.999)/1e3, sim.latency.max/1e3,
+	    (sim.tot_data_sent>0) ? sim.tot_retransmissions*100.0/sim.tot_data_sent : 0,
+	    (sim.tot_pkts_passed>0) ? sim.tot_acks_passed*100.0/sim.tot_pkts_passed : 0);
+    if (sim.tot_repair_sent>0)
+	fprintf(stdout, "\t%d FEC repair packets sent besides the data packets\n",
+		sim.tot_repair_sent);
+    if (sim_threads>1) {
+	if (sim.threads==1)
+	    fprintf(stdout, "\tthe flows ran on one thread, reordered packets leave no lookahead on the shared link\n");
+	else if (sim.lookahead==HUGE_VAL)
+	    fprintf(stdout, "\tthe flows ran on %d threads independently\n", sim.threads);
+	else
+	    fprintf(stdout, "\tthe flows ran on %d threads in %ld windows of %.6fs\n",
+		    sim.threads, sim.windows, sim.lookahead);
+    }
+    if (link_bandwidth>0 || burst_enter>0) {
+	/* separate links are summed up, their busy time is the average */
+	double end_time = sim.end_time;
+	Link data_link, ack_link;
+	int nlinks = shared_link ? 1 : num_flows;
+	for (int f=0; f<nlinks; f++) {
+	    Link *d = sim.flows[f].data_link, *a = sim.flows[f].ack_link;
+	    data_link.busy_time += d->busy_time/nlinks;
+	    data_link.queue_drops += d->queue_drops;
+	    data_link.burst_drops += d->burst_drops;
+	    ack_link.busy_time += a->busy_time/nlinks;
+	    ack_link.queue_drops += a->queue_drops;
+	    ack_link.burst_drops += a->burst_drops;
+	}
+	fprintf(stdout, "\tgoodput is %.2f%% of the %slink bandwidth\n"
+		"\tdata link busy %.2f%% of the time, %ld queue drops, %ld bursty losses\n"
+		"\tack link busy %.2f%% of the time, %ld queue drops, %ld bursty losses\n",
+		(link_bandwidth>0 && end_time>0) ? sim.tot_chars_delivered*8.0/end_time/(link_bandwidth*nlinks)*100.0 : 0,
+		(nlinks>1) ? "total " : "",
+		(end_time>0) ? data_link.busy_time/end_time*100.0 : 0,
+		data_link.queue_drops, data_link.burst_drops,
+		(end_time>0) ? ack_link.busy_time/end_time*100.0 : 0,
+		ack_link.queue_drops, ack_link.burst_drops);
+    }
+    if (num_flows>1) {
+	std::vector<double> goodput;
+	for (int f=0; f<num_flows; f++)
+	    goodput.push_back(sim.flows[f].goodput());
+	fprintf(stdout, "\tjain's fairness index of the goodput of the %d flows is %.4f\n",
+		num_flows, JainIndex(goodput));
+
+	/* a few flows one by one, many as percentiles */
+	if (num_flows<=16) {
+	    for (int f=0; f<num_flows; f++)
+		fprintf(stdout, "\tflow %d: %d characters delivered by %.2fs, %.2f per second%s\n",
+			f, sim.flows[f].tot_chars_delivered, sim.flows[f].end_time,
+			goodput[f], sim.flows[f].passed() ? "" : " (FAILED)");
+	}
+	else {
+	    std::sort(goodput.begin(), goodput.end());
+	    fprintf(stdout, "\t%-32s %12s %12s %12s %12s %12s\n",
+		    "percentile", "p1", "p10", "p50", "p90", "p99");
+	    fprintf(stdout, "\t%-32s %12.2f %12.2f %12.2f %12.2f %12.2f\n",
+		    "flow goodput (characters/s)",
+		    Percentile(goodput, 0.01), Percentile(goodput, 0.10),
+		    Percentile(goodput, 0.50), Percentile(goodput, 0.90),
+		    Percentile(goodput, 0.99));
+	}
+    }
+
+    if (stats_path!=NULL) {
+	FILE *file = fopen(stats_path, "w");
+	if (file==NULL)
+	    fprintf(stderr, "can not create %s\n", stats_path);
+	else {
+	    WriteStats(&sim, file);
+	    fclose(file);
+	}
+    }
 
-    if (message_verfication_passed && (tot_chars_sent==tot_chars_delivered))
+    if (sim.passed())
 	fprintf(stdout, "## Congratulations! This session is error-free, loss-free, and in order.\n");
     else
 	fprintf(stdout, "## Something is wrong! This session is NOT error-free, loss-free, and in order.\n");
@@ -0,0 +1,221 @@
+/*
+ * FILE: rdt_trace.cc
+ * DESCRIPTION: Decoder of the binary traces written by rdt_sim --trace.
+ * NOTE: usage: rdt_trace text|csv|retrans|plot <file> [<flow>]
+ *
+ *       text    - one line per record, like the tracing level 1 printouts
+ *       csv     - one row per record
+ *       retrans - histogram of how many times each data packet is sent
+ *       plot    - sequence/time data of a flow (default 0) for gnuplot,
+ *                 three blocks of "time pkt_ID": the data packets sent for
+ *                 the first time, the retransmissions, and the acks that
+ *                 reach the sender, e.g.
+ *
+ *                 plot "seq.dat" index 0, "" index 1, "" index 2
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <map>
+#include <set>
+#include <vector>
+
+#include "rdt_trace.h"
+
+
+/* records read from the file at once */
+#define READ_RECORDS 65536
+
+/* calls func on every record of the trace, exits if it is not a trace */
+template <class Func>
+static void ReadTrace(const char *path, Func func)
+{
+    FILE *file = fopen(path, "rb");
+    if (file==NULL) {
+	fprintf(stderr, "can not open %s\n", path);
+	exit(-1);
+    }
+
+    TraceHeader header;
+    if (fread(&header, sizeof(header), 1, file)!=1 ||
+	memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic))!=0 ||
+	header.version!=TRACE_VERSION || header.record_size!=sizeof(TraceRecord)) {
+	fprintf(stderr, "%s is not a trace of this version\n", path);
+	exit(-1);
+    }
+
+    std::vector<TraceRecord> block(READ_RECORDS);
+    size_t n;
+    while ((n = fread(&block[0], sizeof(TraceRecord), READ_RECORDS, file))>0) {
+	for (size_t i=0; i<n; i++)
+	    func(block[i]);
+    }
+    fclose(file);
+}
+
+static const char *EventName(int type)
+{
+    static const char *names[TRACE_TYPES] = {
+	"sender_fromupperlayer", "sender_fromlowerlayer", "sender_timeout",
+	"receiver_fromlowerlayer", "receiver_timeout", "sender_tolowerlayer",
+	"receiver_tolowerlayer", "receiver_toupperlayer" };
+    return (type>=0 && type<TRACE_TYPES) ? names[type] : "unknown";
+}
+
+static const char *OutcomeName(int outcome)
+{
+    outcome &= ~TRACE_REPAIR;
+    if (outcome & TRACE_DROPPED) return "dropped";
+    if (outcome & TRACE_LOST) return "lost";
+    if ((outcome & TRACE_CORRUPTED) && (outcome & TRACE_REORDERED))
+	return "corrupted+reordered";
+    if (outcome & TRACE_CORRUPTED) return "corrupted";
+    if (outcome & TRACE_REORDERED) return "reordered";
+    return "delivered";
+}
+
+static void PrintText(const TraceRecord &r)
+{
+    fprintf(stdout, "Time %.6fs flow %d ", r.time, r.flow);
+    switch (r.type) {
+    case TRACE_SENDER_FROMUPPERLAYER:
+	fprintf(stdout, "(Sender): a message of %d bytes from the upper layer.\n", r.id);
+	break;
+    case TRACE_SENDER_FROMLOWERLAYER:
+	fprintf(stdout, "(Sender): ack %d received from the link%s.\n", r.id,
+		(r.outcome & TRACE_CORRUPTED) ? ", corrupted" : "");
+	break;
+    case TRACE_SENDER_TIMEOUT:
+	fprintf(stdout, "(Sender): the timer expires.\n");
+	break;
+    case TRACE_SENDER_TOLOWERLAYER:
+	fprintf(stdout, "(Sender): %s %d passed to the link, %s.\n",
+		(r.outcome & TRACE_REPAIR) ? "repair packet of group" : "packet", r.id,
+		OutcomeName(r.outcome));
+	break;
+    case TRACE_RECEIVER_FROMLOWERLAYER:
+	fprintf(stdout, "(Receiver): %s %d received from the link%s.\n",
+		(r.outcome & TRACE_REPAIR) ? "repair packet of group" : "packet", r.id,
+		(r.outcome & TRACE_CORRUPTED) ? ", corrupted" : "");
+	break;
+    case TRACE_RECEIVER_TIMEOUT:
+	fprintf(stdout, "(Receiver): the timer expires.\n");
+	break;
+    case TRACE_RECEIVER_TOLOWERLAYER:
+	fprintf(stdout, "(Receiver): ack %d passed to the link, %s.\n", r.id,
+		OutcomeName(r.outcome));
+	break;
+    case TRACE_RECEIVER_TOUPPERLAYER:
+	fprintf(stdout, "(Receiver): a message of %d bytes to the upper layer.\n", r.id);
+	break;
+    default:
+	fprintf(stdout, "undefined record %d\n", r.type);
+	break;
+    }
+}
+
+static void PrintCsv(const TraceRecord &r)
+{
+    /* only packets passed to and received from the link have an outcome */
+    bool pkt = (r.type==TRACE_SENDER_TOLOWERLAYER || r.type==TRACE_RECEIVER_TOLOWERLAYER ||
+		r.type==TRACE_SENDER_FROMLOWERLAYER || r.type==TRACE_RECEIVER_FROMLOWERLAYER);
+    fprintf(stdout, "%.6f,%d,%s,%d,%s%s\n", r.time, r.flow, EventName(r.type),
+	    r.id, pkt ? OutcomeName(r.outcome) : "",
+	    (r.outcome & TRACE_REPAIR) ? "+repair" : "");
+}
+
+/* how many times each data packet of each flow is sent, the FEC repair
+   packets are counted on their own */
+static void PrintRetransmissions(const char *path)
+{
+    std::map<std::pair<int,int>, int> sends;
+    long timeouts = 0, lost = 0, repairs = 0;
+    ReadTrace(path, [&](const TraceRecord &r) {
+	if (r.type==TRACE_SENDER_TOLOWERLAYER && (r.outcome & TRACE_REPAIR))
+	    repairs++;
+	else if (r.type==TRACE_SENDER_TOLOWERLAYER) {
+	    sends[std::make_pair(r.flow, r.id)]++;
+	    if (r.outcome & (TRACE_DROPPED|TRACE_LOST|TRACE_CORRUPTED)) lost++;
+	}
+	else if (r.type==TRACE_SENDER_TIMEOUT)
+	    timeouts++;
+    });
+
+    std::map<int, long> histogram;
+    long pkts = 0, transmissions = 0;
+    for (auto it=sends.begin(); it!=sends.end(); ++it) {
+	histogram[it->second]++;
+	pkts++;
+	transmissions += it->second;
+    }
+
+    fprintf(stdout, "## %ld data packets sent %ld times (%ld retransmissions, %.2f%%)\n"
+	    "\t%ld transmissions did not reach the receiver intact\n"
+	    "\t%ld sender timeouts\n"
+	    "\t%ld FEC repair packets sent\n",
+	    pkts, transmissions, transmissions-pkts,
+	    (transmissions>0) ? (transmissions-pkts)*100.0/transmissions : 0,
+	    lost, timeouts, repairs);
+    fprintf(stdout, "\t%8s %12s %8s\n", "sends", "packets", "%");
+    for (auto it=histogram.begin(); it!=histogram.end(); ++it)
+	fprintf(stdout, "\t%8d %12ld %8.2f\n", it->first, it->second,
+		it->second*100.0/pkts);
+}
+
+/* sequence/time plot data of one flow */
+static void PrintPlot(const char *path, int flow)
+{
+    std::vector<std::pair<double,int> > first, again, acks;
+    std::set<int> sent;
+    ReadTrace(path, [&](const TraceRecord &r) {
+	if (r.flow!=flow) return;
+	if (r.type==TRACE_SENDER_TOLOWERLAYER && (r.outcome & TRACE_REPAIR)==0) {
+	    if (sent.insert(r.id).second)
+		first.push_back(std::make_pair(r.time, r.id));
+	    else
+		again.push_back(std::make_pair(r.time, r.id));
+	}
+	else if (r.type==TRACE_RECEIVER_TOLOWERLAYER &&
+		 (r.outcome & (TRACE_DROPPED|TRACE_LOST|TRACE_CORRUPTED))==0)
+	    acks.push_back(std::make_pair(r.time, r.id));
+    });
+
+    const char *titles[3] = { "data packets sent", "retransmissions", "acks" };
+    std::vector<std::pair<double,int> > *blocks[3] = { &first, &again, &acks };
+    for (int b=0; b<3; b++) {
+	if (b>0) fprintf(stdout, "\n\n");
+	fprintf(stdout, "# flow %d: %s\n", flow, titles[b]);
+	for (size_t i=0; i<blocks[b]->size(); i++)
+	    fprintf(stdout, "%.6f %d\n", (*blocks[b])[i].first, (*blocks[b])[i].second);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc<3 || argc>4) {
+	fprintf(stderr, "usage: %s text|csv|retrans|plot <file> [<flow>]\n", argv[0]);
+	exit(-1);
+    }
+    const char *mode = argv[1];
+    const char *path = argv[2];
+
+    if (strcmp(mode, "text")==0)
+	ReadTrace(path, PrintText);
+    else if (strcmp(mode, "csv")==0) {
+	fprintf(stdout, "time,flow,event,id,outcome\n");
+	ReadTrace(path, PrintCsv);
+    }
+    else if (strcmp(mode, "retrans")==0)
+	PrintRetransmissions(path);
+    else if (strcmp(mode, "plot")==0)
+	PrintPlot(path, (argc>3) ? atoi(argv[3]) : 0);
+    else {
+	fprintf(stderr, "invalid mode %s\n", mode);
+	exit(-1);
+    }
+
+    return 0;
+}
@@ -0,0 +1,122 @@
+/*
+ * FILE: rdt_trace.h
+ * DESCRIPTION: The binary trace of the simulator.
+ * NOTE: A trace is a file of fixed-size records, one for every event the
+ *       simulator handles and for every packet and message the rdt layer
+ *       passes to it.  The records are collected in a memory block and
+ *       written out a block at a time, so tracing costs a few stores per
+ *       event instead of a formatted print.  rdt_trace decodes a trace into
+ *       text or CSV, a histogram of the retransmissions, or the data of a
+ *       sequence/time plot.
+ *
+ *       The file starts with a TraceHeader, the records follow until the end
+ *       of the file.
+ */
+
+
+#ifndef _RDT_TRACE_H_
+#define _RDT_TRACE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "rdt_struct.h"
+
+
+/* what a record is about, the first five are the simulator events */
+enum {TRACE_SENDER_FROMUPPERLAYER=0, TRACE_SENDER_FROMLOWERLAYER,
+      TRACE_SENDER_TIMEOUT, TRACE_RECEIVER_FROMLOWERLAYER,
+      TRACE_RECEIVER_TIMEOUT, TRACE_SENDER_TOLOWERLAYER,
+      TRACE_RECEIVER_TOLOWERLAYER, TRACE_RECEIVER_TOUPPERLAYER,
+      TRACE_TYPES};
+
+/* what the link did to a packet passed to the lower layer, 0 if it is
+   delivered normally.  the record of its arrival at the other side repeats
+   the pkt_ID and the outcome, the packet may be corrupted by then */
+#define TRACE_DROPPED   0x01    /* dropped by the link queue */
+#define TRACE_LOST      0x02    /* lost, at random or in a burst */
+#define TRACE_CORRUPTED 0x04
+#define TRACE_REORDERED 0x08    /* not delivered with the normal latency */
+
+/* set on the records of a FEC repair packet, which is neither new data nor
+   a retransmission */
+#define TRACE_REPAIR    0x10
+
+#define TRACE_MAGIC "RDTTRACE"
+#define TRACE_VERSION 1
+
+struct TraceHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+};
+
+struct TraceRecord
+{
+    double time;
+    int32_t flow;
+    int32_t id;             /* pkt_ID of a packet as it was sent, size of a message */
+    uint8_t type;
+    uint8_t outcome;
+    uint8_t unused[6];
+};
+
+/* writes the records of a simulation to a trace file */
+class TraceWriter
+{
+private:
+    FILE *file;
+    TraceRecord *block;
+    int used;
+
+public:
+    /* records per block, 1.5MB */
+    static const int BLOCK_RECORDS = 65536;
+
+    TraceWriter() { file = NULL; block = NULL; used = 0; }
+    ~TraceWriter() { close(); }
+
+    /* start a trace in the file, return false if it can not be created */
+    bool open(const char *path) {
+	file = fopen(path, "wb");
+	if (file==NULL) return false;
+	TraceHeader header;
+	memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+	header.version = TRACE_VERSION;
+	header.record_size = sizeof(TraceRecord);
+	fwrite(&header, sizeof(header), 1, file);
+	block = new TraceRecord[BLOCK_RECORDS];
+	used = 0;
+	return true;
+    }
+
+    void record(double time, int flow, int id, int type, int outcome) {
+	TraceRecord *r = &block[used];
+	r->time = time;
+	r->flow = flow;
+	r->id = id;
+	r->type = type;
+	r->outcome = outcome;
+	memset(r->unused, 0, sizeof(r->unused));
+	if (++used==BLOCK_RECORDS) flush();
+    }
+
+    void flush() {
+	if (used>0) fwrite(block, sizeof(TraceRecord), used, file);
+	used = 0;
+    }
+
+    /* write out the last block and close the file */
+    void close() {
+	if (file==NULL) return;
+	flush();
+	fclose(file);
+	file = NULL;
+	delete[] block;
+	block = NULL;
+    }
+};
+
+#endif  /* _RDT_TRACE_H_ */
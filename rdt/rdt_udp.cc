@@ -0,0 +1,613 @@
+/*
+ * FILE: rdt_udp.cc
+ * DESCRIPTION: Runs the rdt sender and receiver over real UDP sockets.
+ * NOTE: Instead of the simulator, this lower layer carries the packets of
+ *       the rdt layer between two UDP sockets on the loopback interface, so
+ *       that the cost of the protocol per packet can be measured in wall
+ *       clock and CPU time.  The sender and the receiver run in one thread
+ *       around an epoll loop:
+ *
+ *       - the packets passed to the lower layer are collected per socket and
+ *         sent with one sendmmsg() per batch, the packets that arrive are
+ *         read with recvmmsg(), up to <batch> per call
+ *       - Sender_StartTimer()/Receiver_StartTimer() only set a deadline, the
+ *         loop runs the timeouts that are due and has epoll_wait() sleep
+ *         until the earliest deadline, so setting a timer costs no syscall
+ *       - loss, corruption and reordering are injected in the process before
+ *         a packet is sent, like netem would: a lost packet is not sent, a
+ *         corrupted one has random bytes changed as in the simulator, and a
+ *         reordered one is held back for up to twice --delay (at least 1ms)
+ *       - the upper layer generates the messages of the simulator, either
+ *         one every <interval> on average, or with --interval=0 as fast as
+ *         the sender takes them, keeping at most MAX_BACKLOG characters
+ *         outstanding, and verifies them at the receiver
+ *       - the rdt layer gets --timeout=<3 * --delay, at least 3ms> unless it
+ *         is given, a round trip over the loopback is far shorter than the
+ *         TIME_OUT meant for the simulator.  --rto=adaptive keeps the rto
+ *         above 0.1s, so it only suits a --delay of 0.05s or more
+ *
+ *       usage: rdt_udp <messages> <mean_msg_size> <outoforder_rate>
+ *                      <loss_rate> <corrupt_rate>
+ *                      [--interval=<seconds>] [--delay=<seconds>]
+ *                      [--mmsg=<batch>] [--seed=<seed>]
+ *                      [--time-limit=<seconds>] [--timeout=<seconds>]
+ *                      [<switches of the rdt layer>]
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <algorithm>
+#include <queue>
+#include <vector>
+
+#include "rdt_struct.h"
+#include "rdt_sender.h"
+#include "rdt_receiver.h"
+#include "rdt_random.h"
+
+
+/* most packets sent or received with one syscall */
+#define MAX_BATCH 256
+
+/* characters generated but not delivered yet when messages are generated as
+   fast as the sender takes them */
+#define MAX_BACKLOG 65536
+
+/* the fixed rto of the rdt layer unless --timeout is given, in --delay (at
+   least 1ms): the TIME_OUT of the rdt layer is sized for the 0.2s round trip
+   of the simulator, and would stall the loopback at every loss */
+#define TIMEOUT_DELAYS 3.0
+
+/* the socket buffers, large enough that the kernel does not drop packets of
+   a window */
+#define SOCKET_BUFFER (4<<20)
+
+/* a direction of the connection: a socket, the packets waiting to be sent
+   on it, and the packets held back by the injected delay */
+struct Endpoint
+{
+    int fd;
+
+    /* packets to send with the next sendmmsg() */
+    packet out[MAX_BATCH];
+    int nout;
+
+    /* statistics */
+    long pkts_sent;
+    long pkts_dropped;
+    long pkts_received;
+    long pkts_lost;
+    long pkts_corrupted;
+    long pkts_reordered;
+};
+
+/* a packet held back until it is due */
+struct Delayed
+{
+    double due;
+    long seq;
+    Endpoint *ep;
+    packet pkt;
+
+    bool operator<(const Delayed &d) const {
+	if (due!=d.due) return due>d.due;
+	return seq>d.seq;
+    }
+};
+
+
+/*[]------------------------------------------------------------------------[]
+  |  state of the run
+  []------------------------------------------------------------------------[]*/
+
+/* command line switches given as --name=value */
+static std::vector<const char*> udp_options;
+
+static int num_msgs;
+static int msg_size;
+static double outoforder_rate;
+static double loss_rate;
+static double corrupt_rate;
+static double msg_interval;
+static double link_delay;
+static int batch_size;
+
+static Random rng;
+static double start_time;
+
+/* the data direction, from the sender to the receiver, and the acks */
+static Endpoint data_ep;
+static Endpoint ack_ep;
+static std::priority_queue<Delayed> delayed;
+static long delayed_seq = 0;
+
+/* timers, a deadline below 0 is not set */
+static double sender_deadline = -1;
+static double receiver_deadline = -1;
+
+/* messages generated and verified */
+static int msgs_sent = 0;
+static long chars_sent = 0;
+static long chars_delivered = 0;
+static char send_cnt = 0;
+static char verify_cnt = 0;
+static bool verification_passed = true;
+static double next_msg_time = 0;
+
+/* syscalls made by the loop */
+static long sendmmsg_cnt = 0;
+static long recvmmsg_cnt = 0;
+static long epoll_cnt = 0;
+
+
+/*[]------------------------------------------------------------------------[]
+  |  the routines the rdt layer calls
+  []------------------------------------------------------------------------[]*/
+
+static double WallClock()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+/* wall clock time since the start of the run */
+double GetSimulationTime()
+{
+    return WallClock() - start_time;
+}
+
+const char *GetSimulationOption(const char *name, const char *def)
+{
+    size_t len = strlen(name);
+    for (size_t i=0; i<udp_options.size(); i++) {
+	const char *opt = udp_options[i]+2;
+	if (strncmp(opt, name, len)==0 && opt[len]=='=')
+	    return opt+len+1;
+    }
+    return def;
+}
+
+bool IsSimulationQuiet()
+{
+    return false;
+}
+
+void Sender_StartTimer(double timeout)
+{
+    sender_deadline = GetSimulationTime() + timeout;
+}
+
+void Sender_StopTimer()
+{
+    sender_deadline = -1;
+}
+
+bool Sender_isTimerSet()
+{
+    return sender_deadline>=0;
+}
+
+void Receiver_StartTimer(double timeout)
+{
+    receiver_deadline = GetSimulationTime() + timeout;
+}
+
+void Receiver_StopTimer()
+{
+    receiver_deadline = -1;
+}
+
+bool Receiver_isTimerSet()
+{
+    return receiver_deadline>=0;
+}
+
+/* send the packets collected for an endpoint */
+static void Flush(Endpoint *ep)
+{
+    struct mmsghdr msgs[MAX_BATCH];
+    struct iovec iov[MAX_BATCH];
+    int done = 0;
+    while (done<ep->nout) {
+	int n = ep->nout - done;
+	for (int i=0; i<n; i++) {
+	    iov[i].iov_base = ep->out[done+i].data;
+	    iov[i].iov_len = RDT_PKTSIZE;
+	    memset(&msgs[i], 0, sizeof(msgs[i]));
+	    msgs[i].msg_hdr.msg_iov = &iov[i];
+	    msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	sendmmsg_cnt++;
+	int sent = sendmmsg(ep->fd, msgs, n, 0);
+	if (sent<0) {
+	    if (errno==EINTR) continue;
+	    /* a full socket buffer drops the rest, like a full link queue */
+	    if (errno==EAGAIN || errno==ENOBUFS || errno==ECONNREFUSED) break;
+	    perror("sendmmsg");
+	    exit(-1);
+	}
+	done += sent;
+    }
+    ep->pkts_sent += done;
+    ep->pkts_dropped += ep->nout - done;
+    ep->nout = 0;
+}
+
+/* queue a packet for the next sendmmsg() */
+static void Queue(Endpoint *ep, const packet *pkt)
+{
+    ep->out[ep->nout++] = *pkt;
+    if (ep->nout==batch_size)
+	Flush(ep);
+}
+
+/* the packet goes through the injected impairments on its way out */
+static void ToLowerLayer(Endpoint *ep, struct packet *pkt)
+{
+    if (rng.uniform()<loss_rate) {
+	ep->pkts_lost++;
+	return;
+    }
+
+    packet copy = *pkt;
+    if (rng.uniform()<corrupt_rate) {
+	for (int i=0; i<RDT_PKTSIZE; i++)
+	    copy.data[i] = copy.data[i] + (char)(rng.uniform()*20) - 10;
+	ep->pkts_corrupted++;
+    }
+
+    bool reordered = rng.uniform()<outoforder_rate;
+    if (reordered || link_delay>0) {
+	Delayed d;
+	d.due = GetSimulationTime() + link_delay;
+	if (reordered) {
+	    d.due = GetSimulationTime() + std::max(link_delay, 0.001)*2.0*rng.uniform();
+	    ep->pkts_reordered++;
+	}
+	d.seq = delayed_seq++;
+	d.ep = ep;
+	d.pkt = copy;
+	delayed.push(d);
+	return;
+    }
+    Queue(ep, &copy);
+}
+
+void Sender_ToLowerLayer(struct packet *pkt)
+{
+    ToLowerLayer(&data_ep, pkt);
+}
+
+void Receiver_ToLowerLayer(struct packet *pkt)
+{
+    ToLowerLayer(&ack_ep, pkt);
+}
+
+/* the packets are not traced */
+void Sender_PacketInfo(int id, bool repair) {}
+void Receiver_PacketInfo(int id) {}
+
+void Receiver_ToUpperLayer(struct message *msg)
+{
+    for (int i=0; i<msg->size; i++) {
+	if (msg->data[i] != '0' + verify_cnt)
+	    verification_passed = false;
+	verify_cnt = (verify_cnt+1) % 10;
+    }
+    chars_delivered += msg->size;
+}
+
+
+/*[]------------------------------------------------------------------------[]
+  |  main loop
+  []------------------------------------------------------------------------[]*/
+
+/* pass a message of the simulator's kind to the sender */
+static void GenerateMessage()
+{
+    message msg;
+    msg.size = (int)(rng.uniform()*2.0*msg_size);
+    if (msg.size==0) msg.size = 1;
+    std::vector<char> data(msg.size);
+    for (int i=0; i<msg.size; i++) {
+	data[i] = '0' + send_cnt;
+	send_cnt = (send_cnt+1) % 10;
+    }
+    msg.data = &data[0];
+    msgs_sent++;
+    chars_sent += msg.size;
+    Sender_FromUpperLayer(&msg);
+}
+
+/* read what arrived at a socket and hand it to the rdt layer */
+static void Receive(Endpoint *ep, void (*handler)(struct packet *))
+{
+    static packet in[MAX_BATCH];
+    struct mmsghdr msgs[MAX_BATCH];
+    struct iovec iov[MAX_BATCH];
+    for (;;) {
+	for (int i=0; i<batch_size; i++) {
+	    iov[i].iov_base = in[i].data;
+	    iov[i].iov_len = RDT_PKTSIZE;
+	    memset(&msgs[i], 0, sizeof(msgs[i]));
+	    msgs[i].msg_hdr.msg_iov = &iov[i];
+	    msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	recvmmsg_cnt++;
+	int n = recvmmsg(ep->fd, msgs, batch_size, MSG_DONTWAIT, NULL);
+	if (n<0) {
+	    if (errno==EINTR) continue;
+	    if (errno==EAGAIN || errno==ECONNREFUSED) return;
+	    perror("recvmmsg");
+	    exit(-1);
+	}
+	for (int i=0; i<n; i++) {
+	    if (msgs[i].msg_len!=RDT_PKTSIZE) continue;
+	    ep->pkts_received++;
+	    handler(&in[i]);
+	}
+	/* a short batch has emptied the socket */
+	if (n<batch_size) return;
+    }
+}
+
+/* a UDP socket on the loopback interface at an ephemeral port */
+static int OpenSocket(struct sockaddr_in *addr)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM|SOCK_NONBLOCK, 0);
+    if (fd<0) {
+	perror("socket");
+	exit(-1);
+    }
+    int size = SOCKET_BUFFER;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+
+    socklen_t len = sizeof(*addr);
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr->sin_port = 0;
+    if (bind(fd, (struct sockaddr *)addr, len)<0 ||
+	getsockname(fd, (struct sockaddr *)addr, &len)<0) {
+	perror("bind");
+	exit(-1);
+    }
+    return fd;
+}
+
+static double CpuTime()
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec/1e6 +
+	ru.ru_stime.tv_sec + ru.ru_stime.tv_usec/1e6;
+}
+
+int main(int argc, char *argv[])
+{
+    /* separate the switches from the positional arguments */
+    int nargs = 1;
+    for (int i=1; i<argc; i++) {
+	if (strncmp(argv[i], "--", 2)==0)
+	    udp_options.push_back(argv[i]);
+	else
+	    argv[nargs++] = argv[i];
+    }
+    argc = nargs;
+
+    if (argc!=6) {
+	fprintf(stderr, "usage: %s <messages> <mean_msg_size> <outoforder_rate> "
+		"<loss_rate> <corrupt_rate>\n"
+		"\t[--interval=<seconds>] [--delay=<seconds>] [--mmsg=<batch>]\n"
+		"\t[--seed=<seed>] [--time-limit=<seconds>]\n"
+		"\t[--timeout=<seconds>, 3 * --delay (at least 3ms) by default]\n"
+		"\t[<switches of the rdt layer, e.g. --arq=sr --window=64>]\n",
+		argv[0]);
+	exit(-1);
+    }
+
+    num_msgs = atoi(argv[1]);
+    if (num_msgs<=0) {
+	fprintf(stderr, "invalid <messages>\n");
+	exit(-1);
+    }
+    msg_size = atoi(argv[2]);
+    if (msg_size<=0) {
+	fprintf(stderr, "invalid <msg_size>\n");
+	exit(-1);
+    }
+    outoforder_rate = atof(argv[3]);
+    if (outoforder_rate<0 || outoforder_rate>1) {
+	fprintf(stderr, "invalid <outoforder_rate>\n");
+	exit(-1);
+    }
+    loss_rate = atof(argv[4]);
+    if (loss_rate<0 || loss_rate>1) {
+	fprintf(stderr, "invalid <loss_rate>\n");
+	exit(-1);
+    }
+    corrupt_rate = atof(argv[5]);
+    if (corrupt_rate<0 || corrupt_rate>1) {
+	fprintf(stderr, "invalid <corrupt_rate>\n");
+	exit(-1);
+    }
+    msg_interval = atof(GetSimulationOption("interval", "0"));
+    if (msg_interval<0) {
+	fprintf(stderr, "invalid --interval\n");
+	exit(-1);
+    }
+    link_delay = atof(GetSimulationOption("delay", "0"));
+    if (link_delay<0) {
+	fprintf(stderr, "invalid --delay\n");
+	exit(-1);
+    }
+    /* the switches given come first, so a --timeout given wins */
+    static char timeout_option[64];
+    snprintf(timeout_option, sizeof(timeout_option), "--timeout=%g",
+	     TIMEOUT_DELAYS*std::max(link_delay, 0.001));
+    udp_options.push_back(timeout_option);
+    batch_size = atoi(GetSimulationOption("mmsg", "64"));
+    if (batch_size<1 || batch_size>MAX_BATCH) {
+	fprintf(stderr, "invalid --mmsg\n");
+	exit(-1);
+    }
+    double time_limit = atof(GetSimulationOption("time-limit", "60"));
+    if (time_limit<=0) {
+	fprintf(stderr, "invalid --time-limit\n");
+	exit(-1);
+    }
+    const char *seed = GetSimulationOption("seed", NULL);
+    uint64_t rand_seed = (seed!=NULL) ? strtoull(seed, NULL, 0) : getpid();
+    rng.seed(rand_seed);
+
+    /* two sockets connected to each other */
+    struct sockaddr_in data_addr, ack_addr;
+    data_ep.fd = OpenSocket(&data_addr);
+    ack_ep.fd = OpenSocket(&ack_addr);
+    if (connect(data_ep.fd, (struct sockaddr *)&ack_addr, sizeof(ack_addr))<0 ||
+	connect(ack_ep.fd, (struct sockaddr *)&data_addr, sizeof(data_addr))<0) {
+	perror("connect");
+	exit(-1);
+    }
+    int epfd = epoll_create1(0);
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &data_ep;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, data_ep.fd, &ev);
+    ev.data.ptr = &ack_ep;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, ack_ep.fd, &ev);
+
+    fprintf(stdout, "## Reliable data transfer over UDP loopback with:\n"
+	    "\t%d messages of %d bytes on average, %s\n"
+	    "\tout-of-order/loss/corrupt rates are %.2f%%/%.2f%%/%.2f%%, %.3fs delay\n"
+	    "\t%s rto of the rdt layer, %ss timeout\n"
+	    "\tup to %d packets per sendmmsg/recvmmsg, random seed %llu\n",
+	    num_msgs, msg_size,
+	    (msg_interval>0) ? "one every interval" : "as fast as the sender takes them",
+	    outoforder_rate*100.0, loss_rate*100.0, corrupt_rate*100.0, link_delay,
+	    GetSimulationOption("rto", "fixed"), GetSimulationOption("timeout", NULL),
+	    batch_size, (unsigned long long)rand_seed);
+
+    start_time = WallClock();
+    double cpu_start = CpuTime();
+    Sender_Init();
+    Receiver_Init();
+
+    double now = 0;
+    bool timed_out = false;
+    for (;;) {
+	now = GetSimulationTime();
+
+	/* the upper layer */
+	while (msgs_sent<num_msgs) {
+	    if (msg_interval>0 ? now<next_msg_time : chars_sent-chars_delivered>=MAX_BACKLOG)
+		break;
+	    GenerateMessage();
+	    next_msg_time += msg_interval*2.0*rng.uniform();
+	}
+	if (msgs_sent==num_msgs && chars_delivered==chars_sent) break;
+	if (now>time_limit) {
+	    timed_out = true;
+	    break;
+	}
+
+	/* timers due */
+	if (sender_deadline>=0 && sender_deadline<=now) {
+	    sender_deadline = -1;
+	    Sender_Timeout();
+	}
+	if (receiver_deadline>=0 && receiver_deadline<=now) {
+	    receiver_deadline = -1;
+	    Receiver_Timeout();
+	}
+
+	/* packets held back that are due */
+	while (!delayed.empty() && delayed.top().due<=now) {
+	    Delayed d = delayed.top();
+	    delayed.pop();
+	    Queue(d.ep, &d.pkt);
+	}
+	Flush(&data_ep);
+	Flush(&ack_ep);
+
+	/* sleep until a packet arrives or the earliest deadline */
+	double wake = -1;
+	double deadlines[4] = { sender_deadline, receiver_deadline,
+				delayed.empty() ? -1 : delayed.top().due,
+				(msgs_sent<num_msgs && msg_interval>0) ? next_msg_time : -1 };
+	for (int i=0; i<4; i++)
+	    if (deadlines[i]>=0 && (wake<0 || deadlines[i]<wake))
+		wake = deadlines[i];
+	int timeout = -1;
+	if (msgs_sent<num_msgs && msg_interval==0 && chars_sent-chars_delivered<MAX_BACKLOG)
+	    timeout = 0;
+	else if (wake>=0)
+	    timeout = (wake>now) ? (int)((wake-now)*1000 + 0.999) : 0;
+	if (timeout<0 || timeout>100) timeout = 100;
+
+	struct epoll_event events[2];
+	epoll_cnt++;
+	int n = epoll_wait(epfd, events, 2, timeout);
+	for (int i=0; i<n; i++) {
+	    Endpoint *ep = (Endpoint *)events[i].data.ptr;
+	    /* the data socket receives the acks, the ack socket the data */
+	    if (ep==&data_ep)
+		Receive(ep, Sender_FromLowerLayer);
+	    else
+		Receive(ep, Receiver_FromLowerLayer);
+	}
+    }
+    Flush(&data_ep);
+    Flush(&ack_ep);
+
+    double elapsed = GetSimulationTime();
+    double cpu = CpuTime() - cpu_start;
+    Sender_Final();
+    Receiver_Final();
+    close(data_ep.fd);
+    close(ack_ep.fd);
+    close(epfd);
+
+    long pkts = data_ep.pkts_sent + ack_ep.pkts_sent;
+    long syscalls = sendmmsg_cnt + recvmmsg_cnt + epoll_cnt;
+    fprintf(stdout, "\n## Transfer %s after %.3fs with\n"
+	    "\t%d messages, %ld characters sent, %ld delivered\n"
+	    "\t%.2f characters delivered per second (%.2f Mbit/s)\n"
+	    "\t%ld data packets and %ld acks sent, %.0f packets per second\n"
+	    "\t%ld data packets and %ld acks dropped when sendmmsg failed\n"
+	    "\t%ld/%ld/%ld packets lost/corrupted/reordered on purpose\n"
+	    "\t%ld sendmmsg, %ld recvmmsg, %ld epoll_wait: %.3f syscalls per packet\n"
+	    "\t%.3fs cpu time, %.2f us per packet\n",
+	    timed_out ? "timed out" : "completed", elapsed, msgs_sent,
+	    chars_sent, chars_delivered,
+	    (elapsed>0) ? chars_delivered/elapsed : 0,
+	    (elapsed>0) ? chars_delivered*8/elapsed/1e6 : 0,
+	    data_ep.pkts_sent, ack_ep.pkts_sent,
+	    (elapsed>0) ? pkts/elapsed : 0,
+	    data_ep.pkts_dropped, ack_ep.pkts_dropped,
+	    data_ep.pkts_lost + ack_ep.pkts_lost,
+	    data_ep.pkts_corrupted + ack_ep.pkts_corrupted,
+	    data_ep.pkts_reordered + ack_ep.pkts_reordered,
+	    sendmmsg_cnt, recvmmsg_cnt, epoll_cnt,
+	    (pkts>0) ? (double)syscalls/pkts : 0,
+	    cpu, (pkts>0) ? cpu*1e6/pkts : 0);
+
+    if (!timed_out && verification_passed && chars_delivered==chars_sent)
+	fprintf(stdout, "## Congratulations! This session is error-free, loss-free, and in order.\n");
+    else
+	fprintf(stdout, "## Something is wrong! This session is NOT error-free, loss-free, and in order.\n");
+
+    return 0;
+}
@@ -0,0 +1,36 @@
+#!/bin/bash
+# run one simulation of many flows with the flows partitioned over 1 to N
+# threads (N is the number of cores, or the first argument), report the
+# speedup over one thread and check that all of them give the same results
+max=${1:-$(nproc)}
+threads=1
+for ((t=2; t<max; t*=2)); do threads="$threads $t"; done
+[ "$max" -gt 1 ] && threads="$threads $max"
+
+# the results without the lines on the wall clock time and the threads
+results() {
+    grep -v "events processed\|event allocations\|partitioned\|the flows ran"
+}
+
+run() {
+    link=$1; shift
+    base=""
+    printf "%-9s %8s %10s %14s %8s %s\n" "link" "threads" "wall (s)" "events/s" "speedup" "results"
+    for t in $threads; do
+	out=$(echo | ./rdt_sim "$@" --parallel=$t)
+	line=$(echo "$out" | grep "events processed")
+	wall=$(echo "$line" | sed 's/.* in \([0-9.]*\)s .*/\1/')
+	rate=$(echo "$line" | sed 's/.*(\([0-9]*\) events\/s).*/\1/')
+	sum=$(echo "$out" | results | md5sum)
+	if [ -z "$base" ]; then
+	    base=$sum
+	    base_wall=$wall
+	fi
+	[ "$sum" == "$base" ] && same="same" || same="DIFFERENT"
+	printf "%-9s %8d %10.2f %14d %8.2f %s\n" "$link" "$t" "$wall" "$rate" \
+	    "$(echo "$base_wall $wall" | awk '{ print ($2>0) ? $1/$2 : 0 }')" "$same"
+    done
+}
+
+run separate 200 0.01 100 0.1 0.1 0.1 0 --seed=1 --flows=64 --arq=sr
+run shared 200 0.01 100 0 0.1 0.1 0 --seed=1 --flows=64 --arq=sr --link=shared --bandwidth=1e8 --queue=400